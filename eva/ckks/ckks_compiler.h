@@ -7,31 +7,148 @@
 #include "eva/ckks/ckks_config.h"
 #include "eva/ckks/ckks_parameters.h"
 #include "eva/ckks/ckks_signature.h"
+#include "eva/ckks/cost_model.h"
 #include "eva/ckks/eager_relinearizer.h"
 #include "eva/ckks/eager_waterline_rescaler.h"
+#include "eva/ckks/encode_deduplicator.h"
 #include "eva/ckks/encode_inserter.h"
 #include "eva/ckks/encryption_parameter_selector.h"
+#include "eva/ckks/input_packer.h"
+#include "eva/ckks/key_switch_sinker.h"
 #include "eva/ckks/lazy_relinearizer.h"
 #include "eva/ckks/lazy_waterline_rescaler.h"
 #include "eva/ckks/levels_checker.h"
 #include "eva/ckks/minimum_rescaler.h"
 #include "eva/ckks/mod_switcher.h"
+#include "eva/ckks/output_compactor.h"
+#include "eva/ckks/output_packer.h"
 #include "eva/ckks/parameter_checker.h"
 #include "eva/ckks/scales_checker.h"
 #include "eva/ckks/seal_lowering.h"
+#include "eva/ckks/vector_tiler.h"
+#include "eva/common/call_expansion.h"
 #include "eva/common/constant_folder.h"
+#include "eva/common/constant_interner.h"
+#include "eva/common/permutation_lowering.h"
 #include "eva/common/program_traversal.h"
+#include "eva/common/range_analysis.h"
 #include "eva/common/reduction_balancer.h"
 #include "eva/common/rotation_keys_selector.h"
+#include "eva/common/rotation_sinker.h"
+#include "eva/common/tree_height_reducer.h"
 #include "eva/common/type_deducer.h"
 #include "eva/util/logging.h"
+#include <algorithm>
 #include <cstdint>
+#include <numeric>
 #include <seal/util/hestdparms.h>
 
 namespace eva {
 
 class CKKSCompiler {
   CKKSConfig config;
+  CKKSCostModel costModel;
+
+  std::uint32_t getMinInputScale(const Program &program) {
+    std::uint32_t minScale = 0;
+    for (auto &entry : program.getInputs()) {
+      auto &input = entry.second;
+      if (!input->has<EncodeAtScaleAttribute>()) continue;
+      auto scale = input->get<EncodeAtScaleAttribute>();
+      if (minScale == 0 || scale < minScale) minScale = scale;
+    }
+    return minScale;
+  }
+
+  // A rough lower bound on the number of slots available to a program of the
+  // given multiplicative depth, assuming every level consumes a prime of the
+  // smallest input scale. Packing uses this to avoid forcing a larger
+  // polynomial modulus degree than the program needs anyway.
+  std::size_t estimateSlots(const Program &program, std::uint32_t depth) {
+    return getMinDegree((depth + 2) * getMinInputScale(program)) / 2;
+  }
+
+  std::unordered_map<std::string, CKKSPackingInfo>
+  packInputs(Program &program, std::uint32_t &stride) {
+    log(Verbosity::Debug, "Running InputPacker pass");
+    InputPacker ip(program, costModel);
+    ProgramTraversal(program).backwardPass(ip);
+    auto packedInputs = ip.pack(estimateSlots(program, ip.getMaxHeight()));
+    stride = ip.getStride();
+    return packedInputs;
+  }
+
+  std::unordered_map<std::string, CKKSPackingInfo>
+  packOutputs(Program &program, TermMapOptional<std::uint32_t> &scales,
+              std::uint32_t vecSize) {
+    log(Verbosity::Debug, "Running OutputPacker pass");
+    OutputPacker op(program, scales, costModel, vecSize,
+                    getMinInputScale(program));
+    ProgramTraversal(program).forwardPass(op);
+    return op.pack(estimateSlots(program, op.getMaxDepth()));
+  }
+
+  void expandCalls(Program &program) {
+    log(Verbosity::Debug, "Running CallExpansion pass");
+    CallExpansion ce(program);
+    ProgramTraversal(program).forwardPass(ce);
+    ce.expand();
+  }
+
+  void lowerPermutations(Program &program) {
+    log(Verbosity::Debug, "Running PermutationLowering pass");
+    PermutationLowering pl(program, config.permuteKeyBudget,
+                           getMinInputScale(program));
+    ProgramTraversal(program).forwardPass(pl);
+    pl.lower();
+  }
+
+  // Splits the vectors of the program into tiles of the number of slots its
+  // depth needs, if its vector size is larger than that. Returns the tiled
+  // program, or nullptr if no tiling is needed.
+  std::unique_ptr<Program> tileVectors(Program &program) {
+    TermMap<std::uint32_t> depth(program);
+    std::uint32_t maxDepth = 0;
+    bool rotates = false;
+    ProgramTraversal(program).forwardPass([&](Term::Ptr &term) {
+      for (auto &operand : term->getOperands()) {
+        depth[term] = std::max(depth[term], depth[operand]);
+      }
+      if (term->op == Op::Mul) ++depth[term];
+      if (term->op == Op::RotateLeftConst || term->op == Op::RotateRightConst) {
+        rotates = true;
+      }
+      maxDepth = std::max(maxDepth, depth[term]);
+    });
+    // Blending rotated tiles consumes a level
+    if (rotates) ++maxDepth;
+
+    auto maskScale = getMinInputScale(program);
+    auto tileSize = estimateSlots(program, maxDepth);
+    if (maskScale == 0 || program.getVecSize() <= tileSize) return nullptr;
+
+    log(Verbosity::Debug, "Running VectorTiler pass");
+    VectorTiler vt(program, tileSize, maskScale);
+    ProgramTraversal(program).forwardPass(vt);
+    return vt.getTiledProgram();
+  }
+
+  void inferOutputRanges(Program &program) {
+    log(Verbosity::Debug, "Running RangeAnalysis pass");
+    RangeAnalysis ra(program);
+    ProgramTraversal(program).forwardPass(ra);
+    for (auto &entry : program.getOutputs()) {
+      auto &output = entry.second;
+      auto range = ra.getRange(output);
+      // Only tighten ranges, as the user may know of a tighter bound
+      if (range != 0 && (!output->has<RangeAttribute>() ||
+                         range < output->get<RangeAttribute>())) {
+        log(Verbosity::Debug, "Inferred range %u for output %s", range,
+            entry.first.c_str());
+        output->set<RangeAttribute>(range);
+      }
+    }
+  }
 
   void transform(Program &program, TermMap<Type> &types,
                  TermMapOptional<std::uint32_t> &scales) {
@@ -43,6 +160,14 @@ class CKKSCompiler {
     programRewrite.forwardPass(ConstantFolder(
         program, scales)); // currently required because executor/runtime
                            // does not handle this
+    if (config.sinkKeySwitches) {
+      log(Verbosity::Debug, "Running RotationSinker pass");
+      programRewrite.forwardPass(RotationSinker(program, types, scales));
+    }
+    if (config.reduceTreeHeight) {
+      log(Verbosity::Debug, "Running TreeHeightReducer pass");
+      programRewrite.forwardPass(TreeHeightReducer(program, types));
+    }
     if (config.balanceReductions) {
       log(Verbosity::Debug, "Running ReductionCombiner pass");
       programRewrite.forwardPass(ReductionCombiner(program));
@@ -70,6 +195,8 @@ class CKKSCompiler {
     default:
       throw std::logic_error("Unhandled rescaler in CKKSCompiler.");
     }
+    log(Verbosity::Debug, "Running ConstantInterner pass");
+    programRewrite.forwardPass(ConstantInterner(program, scales));
     log(Verbosity::Debug, "Running TypeDeducer pass");
     programRewrite.forwardPass(TypeDeducer(program, types));
 
@@ -92,8 +219,14 @@ class CKKSCompiler {
     programRewrite.forwardPass(TypeDeducer(program, types));
     log(Verbosity::Debug, "Running ModSwitcher pass");
     programRewrite.backwardPass(ModSwitcher(program, types, scales));
+    log(Verbosity::Debug, "Running EncodeDeduplicator pass");
+    programRewrite.forwardPass(EncodeDeduplicator(program));
     log(Verbosity::Debug, "Running TypeDeducer pass");
     programRewrite.forwardPass(TypeDeducer(program, types));
+    if (config.sinkKeySwitches) {
+      log(Verbosity::Debug, "Running KeySwitchSinker pass");
+      programRewrite.forwardPass(KeySwitchSinker(program, types, scales));
+    }
     log(Verbosity::Debug, "Running SEALLowering pass");
     programRewrite.forwardPass(SEALLowering(program, types));
   }
@@ -153,8 +286,41 @@ class CKKSCompiler {
     }
   }
 
+  // The smallest polynomial modulus degree that supports a modulus of bitCount
+  // bits at the configured security level
+  std::size_t getMinDegree(int bitCount) {
+    if (config.securityLevel <= 128) {
+      if (config.quantumSafe)
+        return getMinDegreeForBitCount(&seal::util::seal_he_std_parms_128_tq,
+                                       bitCount);
+      else
+        return getMinDegreeForBitCount(&seal::util::seal_he_std_parms_128_tc,
+                                       bitCount);
+    } else if (config.securityLevel <= 192) {
+      if (config.quantumSafe)
+        return getMinDegreeForBitCount(&seal::util::seal_he_std_parms_192_tq,
+                                       bitCount);
+      else
+        return getMinDegreeForBitCount(&seal::util::seal_he_std_parms_192_tc,
+                                       bitCount);
+    } else if (config.securityLevel <= 256) {
+      if (config.quantumSafe)
+        return getMinDegreeForBitCount(&seal::util::seal_he_std_parms_256_tq,
+                                       bitCount);
+      else
+        return getMinDegreeForBitCount(&seal::util::seal_he_std_parms_256_tc,
+                                       bitCount);
+    } else {
+      throw std::runtime_error(
+          "EVA has support for up to 256 bit security, but " +
+          std::to_string(config.securityLevel) +
+          " bit security was requested.");
+    }
+  }
+
   void determineEncryptionParameters(Program &program,
                                      CKKSParameters &encParams,
+                                     std::size_t &outputPrimes,
                                      TermMapOptional<std::uint32_t> &scales,
                                      TermMap<Type> types) {
     auto programTraverse = ProgramTraversal(program);
@@ -166,40 +332,20 @@ class CKKSCompiler {
     programTraverse.forwardPass(rks);
     encParams.primeBits = eps.getEncryptionParameters();
     encParams.rotations = rks.getRotationKeys();
+    outputPrimes = encParams.primeBits.size() - 1 - eps.getRescaleCount();
+    encParams.needsRelinKeys = false;
+    programTraverse.forwardPass([&](Term::Ptr &term) {
+      if (term->op == Op::Relinearize) encParams.needsRelinKeys = true;
+    });
 
     int bitCount = 0;
     for (auto &logQ : encParams.primeBits)
       bitCount += logQ;
-    if (config.securityLevel <= 128) {
-      if (config.quantumSafe)
-        encParams.polyModulusDegree = getMinDegreeForBitCount(
-            &seal::util::seal_he_std_parms_128_tq, bitCount);
-      else
-        encParams.polyModulusDegree = getMinDegreeForBitCount(
-            &seal::util::seal_he_std_parms_128_tc, bitCount);
-    } else if (config.securityLevel <= 192) {
-      if (config.quantumSafe)
-        encParams.polyModulusDegree = getMinDegreeForBitCount(
-            &seal::util::seal_he_std_parms_192_tq, bitCount);
-      else
-        encParams.polyModulusDegree = getMinDegreeForBitCount(
-            &seal::util::seal_he_std_parms_192_tc, bitCount);
-    } else if (config.securityLevel <= 256) {
-      if (config.quantumSafe)
-        encParams.polyModulusDegree = getMinDegreeForBitCount(
-            &seal::util::seal_he_std_parms_256_tq, bitCount);
-      else
-        encParams.polyModulusDegree = getMinDegreeForBitCount(
-            &seal::util::seal_he_std_parms_256_tc, bitCount);
-    } else {
-      throw std::runtime_error(
-          "EVA has support for up to 256 bit security, but " +
-          std::to_string(config.securityLevel) +
-          " bit security was requested.");
-    }
+    encParams.polyModulusDegree = getMinDegree(bitCount);
 
     auto slots = encParams.polyModulusDegree / 2;
-    if (config.warnVecSize && slots > program.getVecSize()) {
+    if (config.warnVecSize && !config.batchInstances &&
+        slots > program.getVecSize()) {
       warn("Program specifies vector size %i while at least %i slots are "
            "required for security. "
            "This does not affect correctness, as the smaller vector size will "
@@ -252,7 +398,43 @@ class CKKSCompiler {
     }
   }
 
-  CKKSSignature extractSignature(const Program &program) {
+  void compactOutputs(Program &program, const CKKSParameters &encParams,
+                      TermMap<Type> &types,
+                      TermMapOptional<std::uint32_t> &scales) {
+    log(Verbosity::Debug, "Running OutputCompactor pass");
+    OutputCompactor oc(program, types, scales, encParams.primeBits);
+    ProgramTraversal(program).forwardPass(oc);
+    if (oc.hasChanged()) {
+      validate(program, types, scales);
+    }
+  }
+
+  // Rotations move values across the boundaries of instances batched into the
+  // replicas of the vector, unless they rotate by a multiple of the vector
+  // size. Raw rotations are computed on a single replica and are always safe.
+  void checkLaneSafety(Program &program, TermMap<Type> &types) {
+    log(Verbosity::Debug, "Checking rotations are lane-safe");
+    auto vecSize = static_cast<std::int64_t>(program.getVecSize());
+    ProgramTraversal(program).forwardPass([&](Term::Ptr &term) {
+      if (term->op != Op::RotateLeftConst && term->op != Op::RotateRightConst) {
+        return;
+      }
+      if (types[term] == Type::Raw) return;
+      auto rotation = term->get<RotationAttribute>();
+      if (rotation % vecSize != 0) {
+        throw std::runtime_error(
+            "Rotation by " + std::to_string(rotation) +
+            " is not lane-safe, as it moves values between instances batched "
+            "with batch_instances=true");
+      }
+    });
+  }
+
+  CKKSSignature extractSignature(
+      const Program &program, std::uint32_t vecSize,
+      std::unordered_map<std::string, CKKSPackingInfo> packedInputs,
+      std::unordered_map<std::string, CKKSPackingInfo> packedOutputs,
+      std::uint32_t lanes, std::uint32_t tiles, std::uint32_t stride) {
     std::unordered_map<std::string, CKKSEncodingInfo> inputs;
     for (auto &input : program.getInputs()) {
       Type type = input.second->get<TypeAttribute>();
@@ -263,22 +445,76 @@ class CKKSCompiler {
           CKKSEncodingInfo(type, input.second->get<EncodeAtScaleAttribute>(),
                            input.second->get<EncodeAtLevelAttribute>()));
     }
-    return CKKSSignature(program.getVecSize(), std::move(inputs));
+    return CKKSSignature(vecSize, std::move(inputs), std::move(packedInputs),
+                         std::move(packedOutputs), lanes, tiles, stride);
   }
 
-public:
-  CKKSCompiler() {}
-  CKKSCompiler(CKKSConfig config) : config(config) {}
+  // A program compiled up to the choice of its encryption parameters, so that
+  // the parameters can still be replaced by ones shared with other programs
+  struct Compilation {
+    std::unique_ptr<Program> program;
+    std::unique_ptr<TermMap<Type>> types;
+    std::unique_ptr<TermMapOptional<std::uint32_t>> scales;
+    CKKSParameters encParams;
+    std::size_t outputPrimes; // primes before the rescaling primes
+    std::uint32_t vecSize;
+    std::uint32_t tiles = 1;
+    std::uint32_t stride = 1;
+    std::unordered_map<std::string, CKKSPackingInfo> packedInputs;
+    std::unordered_map<std::string, CKKSPackingInfo> packedOutputs;
 
-  std::tuple<std::unique_ptr<Program>, CKKSParameters, CKKSSignature>
-  compile(Program &inputProgram) {
-    auto program = inputProgram.deepCopy();
+    // The primes the program divides by when rescaling, in the order of
+    // primeBits, i.e., the last one is divided by first
+    std::vector<std::uint32_t> getRescalePrimes() const {
+      return std::vector<std::uint32_t>(
+          encParams.primeBits.begin() + outputPrimes,
+          encParams.primeBits.end() - 1);
+    }
+
+    // The bits the program needs left after its last rescaling
+    std::uint32_t getOutputBits() const {
+      return std::accumulate(encParams.primeBits.begin(),
+                             encParams.primeBits.begin() + outputPrimes, 0u);
+    }
+  };
+
+  Compilation prepare(Program &inputProgram) {
+    Compilation c;
+    c.program = inputProgram.deepCopy();
+    c.vecSize = inputProgram.getVecSize();
+    auto &program = c.program;
 
     log(Verbosity::Info, "Compiling %s for CKKS with:\n%s",
         program->getName().c_str(), config.toString(2).c_str());
 
-    TermMap<Type> types(*program);
-    TermMapOptional<std::uint32_t> scales(*program);
+    if (config.batchInstances && (config.packInputs || config.packOutputs)) {
+      throw std::runtime_error("Packing inputs or outputs is not supported "
+                               "together with batch_instances=true");
+    }
+    if (config.batchInstances && config.tileVectors) {
+      throw std::runtime_error("Tiling vectors is not supported together with "
+                               "batch_instances=true");
+    }
+
+    expandCalls(*program);
+    lowerPermutations(*program);
+
+    if (config.tileVectors) {
+      if (auto tiled = tileVectors(*program)) {
+        c.tiles = program->getVecSize() / tiled->getVecSize();
+        program = std::move(tiled);
+      }
+    }
+
+    // Tiles already fill the ciphertexts, so there is nothing to pack
+    if (config.packInputs && c.tiles == 1) {
+      c.packedInputs = packInputs(*program, c.stride);
+    }
+
+    c.types = std::make_unique<TermMap<Type>>(*program);
+    c.scales = std::make_unique<TermMapOptional<std::uint32_t>>(*program);
+    auto &types = *c.types;
+    auto &scales = *c.scales;
     for (auto &source : program->getSources()) {
       // Error out if the scale attribute doesn't exist
       if (!source->has<EncodeAtScaleAttribute>()) {
@@ -294,16 +530,227 @@ public:
       scales[source] = source->get<EncodeAtScaleAttribute>();
     }
 
-    CKKSParameters encParams;
+    inferOutputRanges(*program);
+    // Outputs are spread over all slots when inputs are interleaved
+    if (config.packOutputs && c.tiles == 1 && c.stride == 1) {
+      c.packedOutputs = packOutputs(*program, scales, c.vecSize);
+    }
     transform(*program, types, scales);
     validate(*program, types, scales);
-    determineEncryptionParameters(*program, encParams, scales, types);
+    if (config.batchInstances) {
+      checkLaneSafety(*program, types);
+    }
+    determineEncryptionParameters(*program, c.encParams, c.outputPrimes,
+                                  scales, types);
+    return c;
+  }
+
+  // Finds where the rescaling primes of c can run within primeBits: the index
+  // of the first prime of a matching run, below which enough bits remain for
+  // the outputs. Lower runs leave fewer primes to compute with and are found
+  // first. Returns primeBits.size() if there is no such run.
+  std::size_t findRescalePrimes(const Compilation &c,
+                                const std::vector<std::uint32_t> &primeBits) {
+    auto rescalePrimes = c.getRescalePrimes();
+    auto outputBits = c.getOutputBits();
+    if (primeBits.size() < rescalePrimes.size() + 1) return primeBits.size();
+    auto dataPrimes = primeBits.size() - 1;
+    std::uint32_t bitsBelow = 0;
+    for (std::size_t start = 0; start + rescalePrimes.size() <= dataPrimes;
+         ++start) {
+      if (bitsBelow >= outputBits &&
+          std::equal(rescalePrimes.begin(), rescalePrimes.end(),
+                     primeBits.begin() + start)) {
+        return start;
+      }
+      bitsBelow += primeBits[start];
+    }
+    return primeBits.size();
+  }
+
+  // Makes c run with encParams instead of its own parameters. Inputs and
+  // constants are encoded at the level where the rescaling primes of c start
+  // in encParams, so the primes above them are dropped before computing.
+  void fitParameters(Compilation &c, const CKKSParameters &encParams) {
+    auto &program = *c.program;
+    auto slots = encParams.polyModulusDegree / 2;
+    if (slots < program.getVecSize()) {
+      throw std::runtime_error(
+          "Program " + program.getName() + " has vector size " +
+          std::to_string(program.getVecSize()) + ", but the parameters have " +
+          "only " + std::to_string(slots) + " slots");
+    }
+    for (auto rotation : c.encParams.rotations) {
+      if (encParams.rotations.count(rotation) == 0) {
+        throw std::runtime_error("Program " + program.getName() +
+                                 " needs a rotation key for " +
+                                 std::to_string(rotation) +
+                                 ", which the parameters do not have");
+      }
+    }
+    if (c.encParams.needsRelinKeys && !encParams.needsRelinKeys) {
+      throw std::runtime_error("Program " + program.getName() +
+                               " needs relinearization keys, which the " +
+                               "parameters do not have");
+    }
+    auto start = findRescalePrimes(c, encParams.primeBits);
+    if (start == encParams.primeBits.size()) {
+      throw std::runtime_error(
+          "The primes of the parameters do not match the rescaling of program " +
+          program.getName() + " with room for its outputs");
+    }
+
+    std::uint32_t offset = static_cast<std::uint32_t>(
+        encParams.primeBits.size() - 1 - start - c.getRescalePrimes().size());
+    if (offset > 0) {
+      ProgramTraversal(program).forwardPass([&](Term::Ptr &term) {
+        if (term->has<EncodeAtLevelAttribute>()) {
+          term->set<EncodeAtLevelAttribute>(
+              term->get<EncodeAtLevelAttribute>() + offset);
+        }
+      });
+    }
+    c.encParams = encParams;
+  }
+
+  // Picks parameters all compilations can run with. The rescaling primes of
+  // each one are placed on a matching run of a common chain of primes, which
+  // is extended on top for runs it does not yet hold. The output primes are
+  // those of the compilation that has the fewest bits below its run compared
+  // to what it needs, and the special prime is the largest of all.
+  CKKSParameters shareParameters(std::vector<Compilation> &compilations) {
+    std::vector<Compilation *> order;
+    for (auto &c : compilations) {
+      order.push_back(&c);
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [](const Compilation *a, const Compilation *b) {
+                       return a->getRescalePrimes().size() >
+                              b->getRescalePrimes().size();
+                     });
+
+    std::vector<std::uint32_t> chain;
+    const Compilation *worst = nullptr;
+    std::int64_t worstDeficit = 0;
+    std::uint32_t specialPrime = 0;
+    CKKSParameters shared;
+    shared.polyModulusDegree = 0;
+    shared.needsRelinKeys = false;
+    for (auto c : order) {
+      auto rescalePrimes = c->getRescalePrimes();
+      auto found = std::search(chain.begin(), chain.end(),
+                               rescalePrimes.begin(), rescalePrimes.end());
+      std::size_t start = found - chain.begin();
+      if (found == chain.end() && !rescalePrimes.empty()) {
+        // Overlap the longest prefix of the run with the top of the chain
+        auto overlap = std::min(rescalePrimes.size() - 1, chain.size());
+        while (overlap > 0 &&
+               !std::equal(rescalePrimes.begin(),
+                           rescalePrimes.begin() + overlap,
+                           chain.end() - overlap)) {
+          --overlap;
+        }
+        start = chain.size() - overlap;
+        chain.insert(chain.end(), rescalePrimes.begin() + overlap,
+                     rescalePrimes.end());
+      }
+
+      std::int64_t deficit =
+          std::int64_t(c->getOutputBits()) -
+          std::accumulate(chain.begin(), chain.begin() + start, 0u);
+      if (!worst || deficit > worstDeficit) {
+        worst = c;
+        worstDeficit = deficit;
+      }
+      specialPrime = std::max(specialPrime, c->encParams.primeBits.back());
+      shared.polyModulusDegree = std::max(shared.polyModulusDegree,
+                                          c->encParams.polyModulusDegree);
+      shared.rotations.insert(c->encParams.rotations.begin(),
+                              c->encParams.rotations.end());
+      shared.needsRelinKeys |= c->encParams.needsRelinKeys;
+    }
+
+    shared.primeBits.assign(worst->encParams.primeBits.begin(),
+                            worst->encParams.primeBits.begin() +
+                                worst->outputPrimes);
+    shared.primeBits.insert(shared.primeBits.end(), chain.begin(), chain.end());
+    shared.primeBits.push_back(specialPrime);
+    int bitCount = std::accumulate(shared.primeBits.begin(),
+                                   shared.primeBits.end(), 0);
+    shared.polyModulusDegree = std::max<std::uint32_t>(
+        shared.polyModulusDegree, getMinDegree(bitCount));
+    return shared;
+  }
+
+  std::tuple<std::unique_ptr<Program>, CKKSSignature> finish(Compilation &c) {
+    auto &program = *c.program;
+    if (config.compactOutputs) {
+      compactOutputs(program, c.encParams, *c.types, *c.scales);
+    }
 
-    auto signature = extractSignature(*program);
+    // Each replica of the vector holds a separate instance when batching
+    std::uint32_t lanes = 1;
+    if (config.batchInstances) {
+      lanes = c.encParams.polyModulusDegree / 2 / program.getVecSize();
+    }
+
+    auto signature = extractSignature(
+        program, c.vecSize, std::move(c.packedInputs),
+        std::move(c.packedOutputs), lanes, c.tiles, c.stride);
 
-    return std::make_tuple(std::move(program), std::move(encParams),
+    // The term maps must go before the program they refer to
+    c.scales.reset();
+    c.types.reset();
+    return std::make_tuple(std::move(c.program), std::move(signature));
+  }
+
+public:
+  CKKSCompiler() {}
+  CKKSCompiler(CKKSConfig config) : config(config) {}
+
+  std::tuple<std::unique_ptr<Program>, CKKSParameters, CKKSSignature>
+  compile(Program &inputProgram) {
+    auto c = prepare(inputProgram);
+    auto [program, signature] = finish(c);
+    return std::make_tuple(std::move(program), std::move(c.encParams),
                            std::move(signature));
   }
+
+  // Compiles a program to run with existing encryption parameters, such as
+  // those of another program, so that their keys can be reused. Throws if
+  // the parameters lack rotation keys, slots or primes the program needs.
+  std::tuple<std::unique_ptr<Program>, CKKSSignature>
+  compile(Program &inputProgram, const CKKSParameters &encParams) {
+    auto c = prepare(inputProgram);
+    fitParameters(c, encParams);
+    return finish(c);
+  }
+
+  // Compiles programs to run with a single set of encryption parameters, so
+  // that one set of keys serves all of them and ciphertexts encrypted at the
+  // same scale and level can be passed to any of them
+  std::tuple<std::vector<std::unique_ptr<Program>>, CKKSParameters,
+             std::vector<CKKSSignature>>
+  compileFamily(const std::vector<Program *> &inputPrograms) {
+    if (inputPrograms.empty()) {
+      throw std::runtime_error("No programs to compile");
+    }
+    std::vector<Compilation> compilations;
+    for (auto inputProgram : inputPrograms) {
+      compilations.push_back(prepare(*inputProgram));
+    }
+    auto encParams = shareParameters(compilations);
+    std::vector<std::unique_ptr<Program>> programs;
+    std::vector<CKKSSignature> signatures;
+    for (auto &c : compilations) {
+      fitParameters(c, encParams);
+      auto [program, signature] = finish(c);
+      programs.push_back(std::move(program));
+      signatures.push_back(std::move(signature));
+    }
+    return std::make_tuple(std::move(programs), std::move(encParams),
+                           std::move(signatures));
+  }
 };
 
 } // namespace eva
@@ -20,6 +20,14 @@ CKKSConfig::CKKSConfig(
              "to default.",
              valueStr.c_str());
       }
+    } else if (option == "reduce_tree_height") {
+      std::istringstream is(valueStr);
+      is >> std::boolalpha >> reduceTreeHeight;
+      if (is.bad()) {
+        warn("Could not parse boolean in reduce_tree_height=%s. Falling back "
+             "to default.",
+             valueStr.c_str());
+      }
     } else if (option == "rescaler") {
       if (valueStr == "lazy_waterline") {
         rescaler = CKKSRescaler::LazyWaterline;
@@ -45,6 +53,61 @@ CKKSConfig::CKKSConfig(
              "default.",
              valueStr.c_str());
       }
+    } else if (option == "sink_key_switches") {
+      std::istringstream is(valueStr);
+      is >> std::boolalpha >> sinkKeySwitches;
+      if (is.bad()) {
+        warn("Could not parse boolean in sink_key_switches=%s. Falling back "
+             "to default.",
+             valueStr.c_str());
+      }
+    } else if (option == "compact_outputs") {
+      std::istringstream is(valueStr);
+      is >> std::boolalpha >> compactOutputs;
+      if (is.bad()) {
+        warn("Could not parse boolean in compact_outputs=%s. Falling back "
+             "to default.",
+             valueStr.c_str());
+      }
+    } else if (option == "pack_inputs") {
+      std::istringstream is(valueStr);
+      is >> std::boolalpha >> packInputs;
+      if (is.bad()) {
+        warn("Could not parse boolean in pack_inputs=%s. Falling back "
+             "to default.",
+             valueStr.c_str());
+      }
+    } else if (option == "pack_outputs") {
+      std::istringstream is(valueStr);
+      is >> std::boolalpha >> packOutputs;
+      if (is.bad()) {
+        warn("Could not parse boolean in pack_outputs=%s. Falling back "
+             "to default.",
+             valueStr.c_str());
+      }
+    } else if (option == "batch_instances") {
+      std::istringstream is(valueStr);
+      is >> std::boolalpha >> batchInstances;
+      if (is.bad()) {
+        warn("Could not parse boolean in batch_instances=%s. Falling back "
+             "to default.",
+             valueStr.c_str());
+      }
+    } else if (option == "tile_vectors") {
+      std::istringstream is(valueStr);
+      is >> std::boolalpha >> tileVectors;
+      if (is.bad()) {
+        warn("Could not parse boolean in tile_vectors=%s. Falling back "
+             "to default.",
+             valueStr.c_str());
+      }
+    } else if (option == "permute_key_budget") {
+      std::istringstream is(valueStr);
+      is >> permuteKeyBudget;
+      if (is.bad()) {
+        throw std::runtime_error(
+            "Could not parse unsigned int in permute_key_budget=" + valueStr);
+      }
     } else if (option == "security_level") {
       std::istringstream is(valueStr);
       is >> securityLevel;
@@ -80,6 +143,8 @@ std::string CKKSConfig::toString(int indent) const {
   s << std::boolalpha;
   s << indentStr << "balance_reductions = " << balanceReductions;
   s << '\n';
+  s << indentStr << "reduce_tree_height = " << reduceTreeHeight;
+  s << '\n';
   s << indentStr << "rescaler = ";
   switch (rescaler) {
   case CKKSRescaler::LazyWaterline:
@@ -98,6 +163,20 @@ std::string CKKSConfig::toString(int indent) const {
   s << '\n';
   s << indentStr << "lazy_relinearize = " << lazyRelinearize;
   s << '\n';
+  s << indentStr << "sink_key_switches = " << sinkKeySwitches;
+  s << '\n';
+  s << indentStr << "compact_outputs = " << compactOutputs;
+  s << '\n';
+  s << indentStr << "pack_inputs = " << packInputs;
+  s << '\n';
+  s << indentStr << "pack_outputs = " << packOutputs;
+  s << '\n';
+  s << indentStr << "batch_instances = " << batchInstances;
+  s << '\n';
+  s << indentStr << "tile_vectors = " << tileVectors;
+  s << '\n';
+  s << indentStr << "permute_key_budget = " << permuteKeyBudget;
+  s << '\n';
   s << indentStr << "security_level = " << securityLevel;
   s << '\n';
   s << indentStr << "quantum_safe = " << quantumSafe;
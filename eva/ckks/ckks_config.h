@@ -11,8 +11,16 @@ namespace eva {
 // clang-format off
 const char *const OPTIONS_HELP_MESSAGE =
     "balance_reductions - Balance trees of mul, add or sub operations. bool (default=true)\n"
+    "reduce_tree_height - Distribute multiplications over additions when that reduces depth. bool (default=false)\n"
     "rescaler           - Rescaling policy. One of: lazy_waterline (default), eager_waterline, always, minimum\n"
     "lazy_relinearize   - Relinearize as late as possible. bool (default=true)\n"
+    "sink_key_switches  - Move rotations and relinearizations below rescales and mod switches. bool (default=true)\n"
+    "compact_outputs    - Mod switch outputs to the lowest level that holds their range and scale. bool (default=true)\n"
+    "pack_inputs        - Pack inputs into shared ciphertexts, blocked or interleaved, when estimated to pay off. bool (default=false)\n"
+    "pack_outputs       - Pack outputs into shared ciphertexts when estimated to pay off. bool (default=false)\n"
+    "batch_instances    - Use the replicas of the vector in each ciphertext for separate instances. bool (default=false)\n"
+    "tile_vectors       - Split vectors larger than the depth needs into multiple ciphertexts. bool (default=false)\n"
+    "permute_key_budget - Maximum number of rotation keys for lowering each permute, 0 for no limit. int (default=0)\n"
     "security_level     - How many bits of security parameters should be selected for. int (default=128)\n"
     "quantum_safe       - Select quantum safe parameters. bool (default=false)\n"
     "warn_vec_size      - Warn about possibly inefficient vector size selection. bool (default=true)";
@@ -29,8 +37,16 @@ public:
   std::string toString(int indent = 0) const;
 
   bool balanceReductions = true;
+  bool reduceTreeHeight = false;
   CKKSRescaler rescaler = CKKSRescaler::LazyWaterline;
   bool lazyRelinearize = true;
+  bool sinkKeySwitches = true;
+  bool compactOutputs = true;
+  bool packInputs = false;
+  bool packOutputs = false;
+  bool batchInstances = false;
+  bool tileVectors = false;
+  uint32_t permuteKeyBudget = 0;
   uint32_t securityLevel = 128;
   bool quantumSafe = false;
 
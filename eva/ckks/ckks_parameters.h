@@ -15,6 +15,9 @@ struct CKKSParameters {
   std::vector<std::uint32_t> primeBits; // in log-scale
   std::set<int> rotations;
   std::uint32_t polyModulusDegree;
+  // Relinearization keys are only generated for programs that multiply
+  // ciphertexts together
+  bool needsRelinKeys = true;
 };
 
 std::unique_ptr<msg::CKKSParameters> serialize(const CKKSParameters &);
@@ -22,15 +22,49 @@ struct CKKSEncodingInfo {
       : inputType(inputType), scale(scale), level(level) {}
 };
 
+// Places an input or output of the original program in the slots offset + i *
+// stride for i in [0, vecSize) of a vector of packedSize elements, which is the
+// input or output packedName of the compiled program.
+struct CKKSPackingInfo {
+  std::string packedName;
+  int offset;
+  int packedSize;
+
+  CKKSPackingInfo(std::string packedName, int offset, int packedSize)
+      : packedName(packedName), offset(offset), packedSize(packedSize) {}
+};
+
 struct CKKSSignature {
   int vecSize;
   std::unordered_map<std::string, CKKSEncodingInfo> inputs;
+  std::unordered_map<std::string, CKKSPackingInfo> packedInputs;
+  std::unordered_map<std::string, CKKSPackingInfo> packedOutputs;
+  // Number of independent instances batched into each ciphertext. Instance i
+  // is in the elements [i * vecSize, (i + 1) * vecSize) of inputs and outputs.
+  int lanes;
+  // Number of ciphertexts each input and output is split into. Tile t holds
+  // the elements [t * vecSize / tiles, (t + 1) * vecSize / tiles) and is the
+  // input or output named getTileName(name, t) of the compiled program.
+  int tiles;
+  // Number of slots between consecutive elements of vectors in the compiled
+  // program. Inputs that are not packed have each element repeated stride
+  // times, and outputs are gathered from every stride-th slot.
+  int stride;
 
-  CKKSSignature(int vecSize,
-                std::unordered_map<std::string, CKKSEncodingInfo> inputs)
-      : vecSize(vecSize), inputs(inputs) {}
+  CKKSSignature(
+      int vecSize, std::unordered_map<std::string, CKKSEncodingInfo> inputs,
+      std::unordered_map<std::string, CKKSPackingInfo> packedInputs = {},
+      std::unordered_map<std::string, CKKSPackingInfo> packedOutputs = {},
+      int lanes = 1, int tiles = 1, int stride = 1)
+      : vecSize(vecSize), inputs(inputs), packedInputs(packedInputs),
+        packedOutputs(packedOutputs), lanes(lanes), tiles(tiles),
+        stride(stride) {}
 };
 
+inline std::string getTileName(const std::string &name, int tile) {
+  return name + "#" + std::to_string(tile);
+}
+
 std::unique_ptr<msg::CKKSSignature> serialize(const CKKSSignature &);
 std::unique_ptr<CKKSSignature> deserialize(const msg::CKKSSignature &);
 
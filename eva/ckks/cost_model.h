@@ -0,0 +1,44 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include <cstddef>
+
+namespace eva {
+
+/*
+A rough model of the cost of CKKS operations, used by transformations that
+trade one kind of work for another to decide whether that pays off. Costs are
+in units of one NTT of a single polynomial modulo a single prime, and depend on
+the number of primes the operands have. Transferring ciphertexts is weighted
+by transferWeight, which is the cost of sending one polynomial modulo one
+prime relative to an NTT on it.
+*/
+struct CKKSCostModel {
+  double transferWeight = 4.0;
+
+  // Encoding ends in an NTT for each prime
+  double encode(std::size_t primes) const { return primes; }
+
+  // Encryption encodes and additionally transforms the random polynomials
+  double encrypt(std::size_t primes) const { return 3.0 * primes; }
+
+  // Decryption multiplies by the secret key and transforms back for decoding
+  double decrypt(std::size_t primes) const { return 2.0 * primes; }
+
+  double transfer(std::size_t primes) const {
+    return 2.0 * transferWeight * primes;
+  }
+
+  // Multiplying by a plaintext is elementwise, so the cost is in encoding it
+  double multiplyPlain(std::size_t primes) const { return encode(primes); }
+
+  // Key switching transforms each prime of one polynomial to all primes and
+  // the special prime, and then divides the special prime back out
+  double rotate(std::size_t primes) const {
+    return primes * (primes + 1.0) + 2.0 * primes;
+  }
+};
+
+} // namespace eva
@@ -0,0 +1,44 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include "eva/ir/program.h"
+#include "eva/ir/term_map.h"
+#include <cstdint>
+#include <map>
+#include <tuple>
+
+namespace eva {
+
+/*
+Merges Encode terms that encode the same term at the same scale and level.
+EncodeInserter creates a separate Encode for every use of an unencrypted value,
+so without this pass a value used in many places is encoded as many times at
+runtime. Must be run after ModSwitcher, which assigns the levels.
+*/
+class EncodeDeduplicator {
+  Program &program;
+  std::map<std::tuple<Term *, std::uint32_t, std::uint32_t>, Term::Ptr>
+      encodes;
+
+public:
+  EncodeDeduplicator(Program &g) : program(g) {}
+
+  void
+  operator()(Term::Ptr &term) { // must only be used with forward pass traversal
+    if (term->op != Op::Encode) return;
+
+    auto key = std::make_tuple(term->operandAt(0).get(),
+                               term->get<EncodeAtScaleAttribute>(),
+                               term->get<EncodeAtLevelAttribute>());
+    auto entry = encodes.find(key);
+    if (entry == encodes.end()) {
+      encodes.emplace(key, term);
+    } else {
+      term->replaceAllUsesWith(entry->second);
+    }
+  }
+};
+
+} // namespace eva
@@ -5,6 +5,7 @@
 
 #include "eva/ir/program.h"
 #include "eva/ir/term_map.h"
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
@@ -83,6 +84,16 @@ public:
 
   inline void free(const Term::Ptr &term) { terms_[term].clear(); }
 
+  // The number of rescaling primes on the longest path to an output. These
+  // come right before the special prime in getEncryptionParameters.
+  std::size_t getRescaleCount() {
+    std::size_t count = 0;
+    for (auto &entry : program_.getOutputs()) {
+      count = std::max(count, terms_[entry.second].size());
+    }
+    return count;
+  }
+
   auto getEncryptionParameters() {
     // This function returns the encryption parameters (really just a list of
     // prime bit counts for the coeff_modulus) needed for this computation. It
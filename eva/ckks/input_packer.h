@@ -0,0 +1,282 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include "eva/ckks/ckks_signature.h"
+#include "eva/ckks/cost_model.h"
+#include "eva/ir/program.h"
+#include "eva/ir/term_map.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace eva {
+
+/*
+Packs several encrypted inputs into a single input, so that fewer ciphertexts
+have to be encrypted and transferred. The vector size of the program is widened
+to fit k inputs of the original vector size v, and the inputs are laid out in
+the packed input in one of two ways:
+
+- Blocked: the input at index j is placed in slots [j*v, (j+1)*v). If no
+  rotation depends on the input, only the first v slots of the terms computed
+  from it are ever observed, and rotating the packed input left by j*v moves
+  the input into those slots. Otherwise, the input is masked out of the packed
+  one, rotated into the first v slots and then replicated across the whole
+  vector with log2(k) rotations and additions. As masking consumes a level,
+  this is only done for inputs that are not on the deepest path of the program.
+- Interleaved: element i of the input at index j is placed in slot i*k + j. The
+  whole program is switched to this layout by multiplying its rotations by k
+  and spreading each element of its constants and other inputs over k
+  consecutive slots, so that rotations never move values between the inputs.
+  Rotating the packed input left by j moves the input into the slots observed
+  by the program, and no masking is needed. Outputs are gathered from every
+  k-th slot, which rules out packing them.
+
+Only the layout of the packed input is chosen here. Neither layout changes the
+rotations of the computation itself: interleaving multiplies the step of every
+rotation by k but keeps their number, so layouts that would reduce rotations,
+such as diagonal layouts for matrix products, are not searched for.
+
+Only inputs with equal scale and range are packed together, so that the other
+inputs in the unobserved slots stay within the bounds the program is compiled
+for. The layout and k are chosen with CKKSCostModel, trading the encryptions
+and transfers saved against the extraction work. Blocked layout is preferred
+when both save equally. The number of primes that costs are computed for is
+estimated from the multiplicative depth of the program.
+
+The analysis is done in a backward pass, after which pack performs the
+rewrite and returns the layout of the packed inputs for the signature.
+*/
+class InputPacker {
+  struct Candidate {
+    std::string name;
+    Term::Ptr term;
+    bool masked;
+  };
+
+  Program &program;
+  const CKKSCostModel &costModel;
+  std::uint32_t originalVecSize;
+  TermMap<std::uint32_t> height; // multiplications between a term and outputs
+  TermMap<bool> rotated;         // whether a rotation depends on a term
+  std::vector<Term::Ptr> constants;
+  std::vector<Term::Ptr> rotations;
+  std::uint32_t stride = 1;
+
+  bool isRotationOp(const Op &op_code) {
+    return ((op_code == Op::RotateLeftConst) ||
+            (op_code == Op::RotateRightConst));
+  }
+
+  std::size_t log2(std::size_t k) {
+    std::size_t result = 0;
+    while (k >>= 1) ++result;
+    return result;
+  }
+
+  // Splits each group into packs of at most k inputs and keeps the ones that
+  // save more than they cost. Adds the total saving to saving.
+  std::vector<std::vector<Candidate>>
+  selectPacks(const std::vector<std::vector<Candidate>> &groups, std::size_t k,
+              std::size_t primes, double &saving) {
+    std::vector<std::vector<Candidate>> packs;
+    for (auto &group : groups) {
+      for (std::size_t first = 0; first + 1 < group.size(); first += k) {
+        auto last = std::min(first + k, group.size());
+        double packSaving = (last - first - 1) * (costModel.encrypt(primes) +
+                                                  costModel.transfer(primes));
+        for (auto i = first; i < last; ++i) {
+          if (group[i].masked) {
+            packSaving -= costModel.multiplyPlain(primes) +
+                          log2(k) * costModel.rotate(primes);
+          }
+          if (i > first) packSaving -= costModel.rotate(primes);
+        }
+        if (packSaving > 0) {
+          packs.emplace_back(group.begin() + first, group.begin() + last);
+          saving += packSaving;
+        }
+      }
+    }
+    return packs;
+  }
+
+  // Groups inputs by scale and range, with the ones that need no masking first
+  // so that they get the cheapest positions
+  std::vector<std::vector<Candidate>> makeGroups(bool interleaved,
+                                                 std::uint32_t maxHeight) {
+    std::map<std::pair<std::uint32_t, std::uint32_t>, std::vector<Candidate>>
+        groupMap;
+    for (auto &entry : program.getInputs()) {
+      auto &input = entry.second;
+      if (input->get<TypeAttribute>() != Type::Cipher ||
+          input->numUses() == 0 || !input->has<EncodeAtScaleAttribute>()) {
+        continue;
+      }
+      bool masked = !interleaved && rotated[input];
+      if (masked && height[input] + 1 > maxHeight) continue;
+      std::uint32_t range =
+          input->has<RangeAttribute>() ? input->get<RangeAttribute>() : 0;
+      groupMap[{input->get<EncodeAtScaleAttribute>(), range}].push_back(
+          {entry.first, input, masked});
+    }
+    std::vector<std::vector<Candidate>> groups;
+    for (auto &entry : groupMap) {
+      auto &group = entry.second;
+      std::sort(group.begin(), group.end(),
+                [](const Candidate &a, const Candidate &b) {
+                  return std::make_pair(a.masked, a.name) <
+                         std::make_pair(b.masked, b.name);
+                });
+      groups.push_back(std::move(group));
+    }
+    return groups;
+  }
+
+  // Switches the program to the interleaved layout with k inputs
+  void interleave(std::uint32_t k) {
+    std::vector<double> scratch;
+    for (auto &constant : constants) {
+      auto &values = constant->get<ConstantValueAttribute>()->expand(
+          scratch, originalVecSize);
+      std::vector<double> spread;
+      spread.reserve(k * values.size());
+      for (auto value : values) {
+        spread.insert(spread.end(), k, value);
+      }
+      constant->set<ConstantValueAttribute>(
+          std::make_shared<DenseConstantValue>(program.getVecSize(), spread));
+    }
+    for (auto &rotation : rotations) {
+      rotation->set<RotationAttribute>(rotation->get<RotationAttribute>() * k);
+    }
+  }
+
+  std::string makePackedName(std::size_t index) {
+    auto name = "packed_" + std::to_string(index);
+    while (program.getInputs().count(name) != 0) {
+      name = "_" + name;
+    }
+    return name;
+  }
+
+  Term::Ptr extract(const Term::Ptr &packed, const Candidate &candidate,
+                    std::uint32_t offset, std::uint32_t scale) {
+    auto vecSize = program.getVecSize();
+    auto value = packed;
+    if (candidate.masked) {
+      std::vector<double> maskValues(vecSize, 0.0);
+      std::fill(maskValues.begin() + offset,
+                maskValues.begin() + offset + originalVecSize, 1.0);
+      auto mask = program.makeDenseConstant(maskValues);
+      mask->set<EncodeAtScaleAttribute>(scale);
+      value = program.makeTerm(Op::Mul, {value, mask});
+    }
+    if (offset > 0) value = program.makeLeftRotation(value, offset);
+    if (candidate.masked) {
+      for (auto step = originalVecSize; step < vecSize; step *= 2) {
+        value = program.makeTerm(Op::Add,
+                                 {value, program.makeRightRotation(value, step)});
+      }
+    }
+    return value;
+  }
+
+public:
+  InputPacker(Program &g, const CKKSCostModel &costModel)
+      : program(g), costModel(costModel), originalVecSize(g.getVecSize()),
+        height(g), rotated(g) {}
+
+  // The multiplicative depth of the program, available after the pass
+  std::uint32_t getMaxHeight() {
+    std::uint32_t maxHeight = 0;
+    for (auto &source : program.getSources()) {
+      maxHeight = std::max(maxHeight, height[source]);
+    }
+    return maxHeight;
+  }
+
+  void operator()(
+      Term::Ptr &term) { // must only be used with backward pass traversal
+    for (auto &use : term->getUses()) {
+      auto useHeight = height[use] + (use->op == Op::Mul ? 1 : 0);
+      height[term] = std::max(height[term], useHeight);
+      if (isRotationOp(use->op) || rotated[use]) rotated[term] = true;
+    }
+    if (term->op == Op::Constant) constants.push_back(term);
+    if (isRotationOp(term->op)) rotations.push_back(term);
+  }
+
+  // The number of slots between consecutive elements of a vector in the
+  // chosen layout, available after pack
+  std::uint32_t getStride() { return stride; }
+
+  // Packs inputs into vectors of at most maxVecSize elements. Returns the
+  // layout of each input that was packed.
+  std::unordered_map<std::string, CKKSPackingInfo>
+  pack(std::size_t maxVecSize) {
+    auto maxHeight = getMaxHeight();
+
+    // Pick the layout and the number of inputs per packed input that save
+    // the most
+    auto primes = maxHeight + 2;
+    std::size_t bestK = 0;
+    bool bestInterleaved = false;
+    double bestSaving = 0;
+    for (bool interleaved : {false, true}) {
+      auto groups = makeGroups(interleaved, maxHeight);
+      for (std::size_t k = 2; k * originalVecSize <= maxVecSize; k *= 2) {
+        double saving = 0;
+        selectPacks(groups, k, primes, saving);
+        if (saving > bestSaving) {
+          bestK = k;
+          bestInterleaved = interleaved;
+          bestSaving = saving;
+        }
+      }
+    }
+    if (bestK == 0) return {};
+
+    double saving = 0;
+    auto packs = selectPacks(makeGroups(bestInterleaved, maxHeight), bestK,
+                             primes, saving);
+    program.widenVecSize(bestK * originalVecSize);
+    if (bestInterleaved) {
+      interleave(bestK);
+      stride = bestK;
+    }
+
+    std::unordered_map<std::string, CKKSPackingInfo> packedInputs;
+    for (std::size_t i = 0; i < packs.size(); ++i) {
+      auto &pack = packs[i];
+      auto &first = pack[0].term;
+      auto scale = first->get<EncodeAtScaleAttribute>();
+      auto name = makePackedName(i);
+      auto packed = program.makeInput(name, Type::Cipher);
+      packed->set<EncodeAtScaleAttribute>(scale);
+      if (first->has<RangeAttribute>()) {
+        packed->set<RangeAttribute>(first->get<RangeAttribute>());
+      }
+      for (std::size_t j = 0; j < pack.size(); ++j) {
+        auto offset = static_cast<std::uint32_t>(
+            bestInterleaved ? j : j * originalVecSize);
+        pack[j].term->replaceAllUsesWith(
+            extract(packed, pack[j], offset, scale));
+        program.removeInput(pack[j].name);
+        packedInputs.emplace(pack[j].name,
+                             CKKSPackingInfo(name, offset,
+                                             program.getVecSize()));
+      }
+    }
+    return packedInputs;
+  }
+};
+
+} // namespace eva
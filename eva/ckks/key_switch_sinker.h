@@ -0,0 +1,71 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include "eva/ir/program.h"
+#include "eva/ir/term_map.h"
+#include <vector>
+
+namespace eva {
+
+/*
+Moves rescales and mod switches above the rotations and relinearizations that
+directly precede them, so that key switching is performed at the lowest
+possible level. Key switching cost grows with the number of remaining primes,
+while rescaling and mod switching commute with both rotations and
+relinearization.
+
+A chain x -> k1 -> ... -> kn -> t, where t is a Rescale or ModSwitch and each
+ki is a single-use rotation or relinearization, is rewired into
+x -> t -> k1 -> ... -> kn. The relative order of the key switches is kept, so
+a relinearization still precedes any rotation it did before. Must be run
+after ModSwitcher, as the inserted mod switches are also sunk below.
+*/
+class KeySwitchSinker {
+  Program &program;
+  TermMap<Type> &type;
+  TermMapOptional<std::uint32_t> &scale;
+
+  bool isKeySwitchOp(const Op &op_code) {
+    return ((op_code == Op::RotateLeftConst) ||
+            (op_code == Op::RotateRightConst) ||
+            (op_code == Op::Relinearize));
+  }
+
+  bool isLevelDropOp(const Op &op_code) {
+    return ((op_code == Op::Rescale) || (op_code == Op::ModSwitch));
+  }
+
+public:
+  KeySwitchSinker(Program &g, TermMap<Type> &type,
+                  TermMapOptional<std::uint32_t> &scale)
+      : program(g), type(type), scale(scale) {}
+
+  void
+  operator()(Term::Ptr &term) { // must only be used with forward pass traversal
+    if (!isLevelDropOp(term->op)) return;
+    if (type[term] != Type::Cipher) return;
+
+    // Collect the chain of key switches from the operand upwards
+    std::vector<Term::Ptr> chain;
+    auto operand = term->operandAt(0);
+    while (isKeySwitchOp(operand->op) && operand->numUses() == 1) {
+      chain.push_back(operand);
+      operand = operand->operandAt(0);
+    }
+    if (chain.empty()) return;
+
+    auto &last = chain.front();  // direct operand of term
+    auto &first = chain.back();  // uses operand
+    term->replaceAllUsesWith(last);
+    term->replaceOperand(last, operand);
+    first->replaceOperand(operand, term);
+
+    for (auto &keySwitch : chain) {
+      scale[keySwitch] = scale[term];
+    }
+  }
+};
+
+} // namespace eva
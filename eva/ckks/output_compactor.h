@@ -0,0 +1,90 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include "eva/ir/program.h"
+#include "eva/ir/term_map.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace eva {
+
+/*
+Inserts modulus switches before outputs to drop them to the lowest level that
+still holds their range and scale. Otherwise all outputs end on the same level,
+which holds the output with the largest range and scale. Other outputs then
+carry primes they do not need, making them larger to transfer and slower to
+decrypt.
+
+Must be run with the prime bit counts selected by EncryptionParametersSelector,
+where the last prime is the special prime and the remaining ones are consumed
+from the end of the list as levels are dropped.
+*/
+class OutputCompactor {
+  Program &program;
+  TermMap<Type> &type;
+  TermMapOptional<std::uint32_t> &scale;
+  const std::vector<std::uint32_t> &primeBits;
+  TermMap<std::uint32_t> level;
+  bool changed = false;
+
+  bool isLevelDropOp(const Op &op_code) {
+    return ((op_code == Op::Rescale) || (op_code == Op::ModSwitch));
+  }
+
+  // The number of primes an output needs to hold its range and scale
+  std::size_t getMinPrimes(const Term::Ptr &output) {
+    std::uint32_t bits = output->get<RangeAttribute>() + scale[output];
+    std::uint32_t bitsAvailable = 0;
+    std::size_t count = 0;
+    while (bitsAvailable < bits && count < primeBits.size() - 1) {
+      bitsAvailable += primeBits[count];
+      ++count;
+    }
+    return count;
+  }
+
+public:
+  OutputCompactor(Program &g, TermMap<Type> &type,
+                  TermMapOptional<std::uint32_t> &scale,
+                  const std::vector<std::uint32_t> &primeBits)
+      : program(g), type(type), scale(scale), primeBits(primeBits), level(g) {}
+
+  bool hasChanged() const { return changed; }
+
+  void
+  operator()(Term::Ptr &term) { // must only be used with forward pass traversal
+    if (term->numOperands() == 0 || term->op == Op::Encode) {
+      level[term] = term->get<EncodeAtLevelAttribute>();
+      return;
+    }
+    // Only ciphertexts have a meaningful level
+    for (auto &operand : term->getOperands()) {
+      if (type[operand] == Type::Cipher) level[term] = level[operand];
+    }
+    if (isLevelDropOp(term->op)) ++level[term];
+
+    auto operand = term->operandAt(0);
+    if (term->op != Op::Output || type[operand] != Type::Cipher) return;
+
+    auto dataPrimes = primeBits.size() - 1;
+    assert(level[operand] < dataPrimes);
+    auto primes = dataPrimes - level[operand];
+    auto minPrimes = getMinPrimes(term);
+    if (primes <= minPrimes) return;
+
+    auto temp = operand;
+    for (; primes > minPrimes; --primes) {
+      temp = program.makeTerm(Op::ModSwitch, {temp});
+      type[temp] = Type::Cipher;
+      scale[temp] = scale[operand];
+    }
+    term->replaceOperand(operand, temp);
+    level[term] = dataPrimes - minPrimes;
+    changed = true;
+  }
+};
+
+} // namespace eva
@@ -0,0 +1,222 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include "eva/ckks/ckks_signature.h"
+#include "eva/ckks/cost_model.h"
+#include "eva/ir/program.h"
+#include "eva/ir/term_map.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace eva {
+
+/*
+Merges several encrypted outputs into disjoint slot ranges of a single output,
+so that fewer ciphertexts have to be transferred and decrypted. The output at
+index j is masked to its first v slots, where v is the vector size of the
+original program, and rotated right by j*v. The results are summed into the
+packed output. The vector size of the program is widened if needed to fit k
+outputs.
+
+Masking consumes a level. Outputs that are not on the deepest path of the
+program have a level to spare, while packing the other outputs adds a level to
+the whole program. Whether packing pays off is decided with CKKSCostModel,
+trading the transfers and decryptions saved against the masking and rotations,
+and the cost of the extra level when one is needed. Outputs are assumed to be
+returned with a single prime.
+
+The analysis is done in a forward pass, after which pack performs the rewrite
+and returns the layout of the packed outputs for the signature.
+*/
+class OutputPacker {
+  struct Candidate {
+    std::string name;
+    Term::Ptr term;
+    bool needsLevel;
+  };
+
+  Program &program;
+  TermMapOptional<std::uint32_t> &scale;
+  const CKKSCostModel &costModel;
+  std::uint32_t originalVecSize;
+  std::uint32_t maskScale;
+  TermMap<std::uint32_t> depth; // multiplications between inputs and a term
+  TermMap<bool> encrypted;
+  std::size_t keySwitches = 0;
+  std::size_t encryptedInputs = 0;
+
+  bool isRotationOp(const Op &op_code) {
+    return ((op_code == Op::RotateLeftConst) ||
+            (op_code == Op::RotateRightConst));
+  }
+
+  // The cost of adding a level, which adds a prime to every key switch and
+  // every encrypted input
+  double extraLevelCost() {
+    auto primes = getMaxDepth() + 2;
+    return keySwitches *
+               (costModel.rotate(primes + 1) - costModel.rotate(primes)) +
+           encryptedInputs * (costModel.encrypt(1) + costModel.transfer(1));
+  }
+
+  // Splits the candidates into packs of at most k outputs and keeps the ones
+  // that save more than they cost. Returns the total saving.
+  double selectPacks(const std::vector<Candidate> &candidates, std::size_t k,
+                     std::vector<std::vector<Candidate>> &packs) {
+    double saving = 0;
+    bool needsLevel = false;
+    for (std::size_t first = 0; first + 1 < candidates.size(); first += k) {
+      auto last = std::min(first + k, candidates.size());
+      double packSaving =
+          (last - first - 1) * (costModel.transfer(1) + costModel.decrypt(1));
+      packSaving -= (last - first) * costModel.multiplyPlain(1);
+      packSaving -= (last - first - 1) * costModel.rotate(1);
+      if (packSaving > 0) {
+        packs.emplace_back(candidates.begin() + first,
+                           candidates.begin() + last);
+        saving += packSaving;
+        for (auto i = first; i < last; ++i) {
+          needsLevel = needsLevel || candidates[i].needsLevel;
+        }
+      }
+    }
+    if (needsLevel) saving -= extraLevelCost();
+    return saving;
+  }
+
+  std::string makePackedName(std::size_t index) {
+    auto name = "packed_" + std::to_string(index);
+    while (program.getOutputs().count(name) != 0) {
+      name = "_" + name;
+    }
+    return name;
+  }
+
+public:
+  OutputPacker(Program &g, TermMapOptional<std::uint32_t> &scale,
+               const CKKSCostModel &costModel, std::uint32_t originalVecSize,
+               std::uint32_t maskScale)
+      : program(g), scale(scale), costModel(costModel),
+        originalVecSize(originalVecSize), maskScale(maskScale), depth(g),
+        encrypted(g) {}
+
+  // The multiplicative depth of the program, available after the pass
+  std::uint32_t getMaxDepth() {
+    std::uint32_t maxDepth = 0;
+    for (auto &entry : program.getOutputs()) {
+      maxDepth = std::max(maxDepth, depth[entry.second]);
+    }
+    return maxDepth;
+  }
+
+  void
+  operator()(Term::Ptr &term) { // must only be used with forward pass traversal
+    if (term->op == Op::Input) {
+      encrypted[term] = term->get<TypeAttribute>() == Type::Cipher;
+      if (encrypted[term]) ++encryptedInputs;
+      return;
+    }
+    std::size_t encryptedOperands = 0;
+    for (auto &operand : term->getOperands()) {
+      depth[term] = std::max(depth[term], depth[operand]);
+      if (encrypted[operand]) ++encryptedOperands;
+    }
+    encrypted[term] = encryptedOperands > 0;
+    if (term->op == Op::Mul) {
+      ++depth[term];
+      if (encryptedOperands == 2) ++keySwitches;
+    }
+    if (isRotationOp(term->op) && encrypted[term]) ++keySwitches;
+  }
+
+  // Packs outputs into vectors of at most maxVecSize elements. Returns the
+  // layout of each output that was packed.
+  std::unordered_map<std::string, CKKSPackingInfo>
+  pack(std::size_t maxVecSize) {
+    if (maskScale == 0) return {};
+
+    // Outputs with a level to spare come first so that packing them alone can
+    // be chosen when adding a level does not pay off
+    auto maxDepth = getMaxDepth();
+    std::vector<Candidate> candidates;
+    for (auto &entry : program.getOutputs()) {
+      auto &output = entry.second;
+      if (!encrypted[output]) continue;
+      candidates.push_back(
+          {entry.first, output, depth[output] + 1 > maxDepth});
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [](const Candidate &a, const Candidate &b) {
+                return std::make_pair(a.needsLevel, a.name) <
+                       std::make_pair(b.needsLevel, b.name);
+              });
+    auto withSpareLevel = static_cast<std::size_t>(
+        std::count_if(candidates.begin(), candidates.end(),
+                      [](const Candidate &c) { return !c.needsLevel; }));
+
+    // Pick the number of outputs per packed output that saves the most, either
+    // with only the outputs that have a level to spare or with all of them
+    std::vector<std::vector<Candidate>> bestPacks;
+    std::size_t bestK = 0;
+    double bestSaving = 0;
+    for (std::size_t k = 2; k * originalVecSize <= maxVecSize; k *= 2) {
+      for (auto count : {withSpareLevel, candidates.size()}) {
+        std::vector<Candidate> subset(candidates.begin(),
+                                      candidates.begin() + count);
+        std::vector<std::vector<Candidate>> packs;
+        auto saving = selectPacks(subset, k, packs);
+        if (saving > bestSaving) {
+          bestSaving = saving;
+          bestPacks = std::move(packs);
+          bestK = k;
+        }
+      }
+    }
+    if (bestPacks.empty()) return {};
+
+    auto packedSize = bestK * originalVecSize;
+    if (packedSize > program.getVecSize()) program.widenVecSize(packedSize);
+
+    // All packed outputs keep only the first originalVecSize slots of each
+    // output before moving it into place
+    auto vecSize = program.getVecSize();
+    std::vector<double> maskValues(vecSize, 0.0);
+    std::fill(maskValues.begin(), maskValues.begin() + originalVecSize, 1.0);
+    auto mask = program.makeDenseConstant(maskValues);
+    mask->set<EncodeAtScaleAttribute>(maskScale);
+    scale[mask] = maskScale;
+
+    std::unordered_map<std::string, CKKSPackingInfo> packedOutputs;
+    for (std::size_t i = 0; i < bestPacks.size(); ++i) {
+      auto &pack = bestPacks[i];
+      auto name = makePackedName(i);
+      Term::Ptr sum;
+      std::uint32_t range = 0;
+      for (std::size_t j = 0; j < pack.size(); ++j) {
+        auto &output = pack[j].term;
+        if (output->has<RangeAttribute>()) {
+          range = std::max(range, output->get<RangeAttribute>());
+        }
+        auto offset = static_cast<std::uint32_t>(j * originalVecSize);
+        auto value = program.makeTerm(Op::Mul, {output->operandAt(0), mask});
+        if (offset > 0) value = program.makeRightRotation(value, offset);
+        sum = sum ? program.makeTerm(Op::Add, {sum, value}) : value;
+        program.removeOutput(pack[j].name);
+        packedOutputs.emplace(pack[j].name,
+                              CKKSPackingInfo(name, offset, vecSize));
+      }
+      auto packed = program.makeOutput(name, sum);
+      if (range != 0) packed->set<RangeAttribute>(range);
+    }
+    return packedOutputs;
+  }
+};
+
+} // namespace eva
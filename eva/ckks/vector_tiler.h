@@ -0,0 +1,184 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include "eva/ckks/ckks_signature.h"
+#include "eva/ir/program.h"
+#include "eva/ir/term_map.h"
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace eva {
+
+/*
+Splits the vectors of a program into tiles that each fit in a ciphertext with
+fewer slots than the vector size, so that a large vector size does not force a
+larger polynomial modulus degree than the depth of the program needs. A vector
+of size V is held in T = V/S tiles of tileSize S, with tile t holding the
+elements [t*S, (t+1)*S). Inputs and outputs are split into T inputs and outputs
+named with getTileName.
+
+Elementwise operations map tile by tile, so the tiles are independent and can
+be evaluated in parallel. Rotating left by r = q*S + s moves element i of tile t
+to tile t-q, or to tile t-q-1 if it crosses a tile boundary. When s is not zero
+each tile of the result is thus blended from two rotated tiles of the operand:
+
+  out[t] = b + (a - b) * lo,  a = x[t+q] << s,  b = x[t+q+1] << s
+
+where lo is a mask of ones in the first S-s slots. Each tile of the operand is
+rotated once and shared by the two tiles of the result using it. The mask is
+encoded at maskScale, and its multiplication consumes a level.
+
+The rewrite is done in a forward pass that builds a new program, which is
+available from getTiledProgram afterwards.
+*/
+class VectorTiler {
+  Program &program;
+  std::uint32_t tileSize;
+  std::uint32_t tiles;
+  std::uint32_t maskScale;
+  std::unique_ptr<Program> tiled;
+  TermMap<std::vector<Term::Ptr>> tile;
+  std::unordered_map<Term *, std::string> inputNames;
+  std::unordered_map<Term *, std::string> outputNames;
+  std::map<std::uint32_t, Term::Ptr> masks;
+  std::vector<double> scratch;
+
+  Term::Ptr getMask(std::uint32_t shift) {
+    auto &mask = masks[shift];
+    if (!mask) {
+      std::vector<double> values(tileSize, 0.0);
+      std::fill(values.begin(), values.end() - shift, 1.0);
+      mask = tiled->makeDenseConstant(values);
+      mask->set<EncodeAtScaleAttribute>(maskScale);
+    }
+    return mask;
+  }
+
+  void tileInput(const Term::Ptr &term, std::vector<Term::Ptr> &result) {
+    auto &name = inputNames.at(term.get());
+    for (std::uint32_t t = 0; t < tiles; ++t) {
+      result[t] = tiled->makeInput(getTileName(name, t),
+                                   term->get<TypeAttribute>());
+      result[t]->assignAttributesFrom(*term);
+    }
+  }
+
+  void tileOutput(const Term::Ptr &term, std::vector<Term::Ptr> &result) {
+    auto &name = outputNames.at(term.get());
+    auto &operand = tile[term->operandAt(0)];
+    for (std::uint32_t t = 0; t < tiles; ++t) {
+      result[t] = tiled->makeOutput(getTileName(name, t), operand[t]);
+      result[t]->assignAttributesFrom(*term);
+    }
+  }
+
+  // Constants that repeat with a period dividing the tile size are shared by
+  // all tiles
+  void tileConstant(const Term::Ptr &term, std::vector<Term::Ptr> &result) {
+    auto &values = term->get<ConstantValueAttribute>()->expand(
+        scratch, program.getVecSize());
+    for (std::uint32_t t = 0; t < tiles; ++t) {
+      auto first = values.begin() + t * tileSize;
+      if (t > 0 && std::equal(first, first + tileSize, values.begin())) {
+        result[t] = result[0];
+        continue;
+      }
+      result[t] = tiled->makeTerm(Op::Constant);
+      result[t]->assignAttributesFrom(*term);
+      result[t]->set<ConstantValueAttribute>(
+          std::make_shared<DenseConstantValue>(
+              tileSize, std::vector<double>(first, first + tileSize)));
+    }
+  }
+
+  void tileRotation(const Term::Ptr &term, std::vector<Term::Ptr> &result) {
+    auto &operand = tile[term->operandAt(0)];
+    std::int64_t vecSize = program.getVecSize();
+    std::int64_t rotation = term->get<RotationAttribute>() % vecSize;
+    if (term->op == Op::RotateRightConst) rotation = -rotation;
+    if (rotation < 0) rotation += vecSize;
+    auto q = static_cast<std::uint32_t>(rotation / tileSize);
+    auto s = static_cast<std::uint32_t>(rotation % tileSize);
+    if (s == 0) {
+      for (std::uint32_t t = 0; t < tiles; ++t) {
+        result[t] = operand[(t + q) % tiles];
+      }
+      return;
+    }
+    std::vector<Term::Ptr> rotated(tiles);
+    for (std::uint32_t t = 0; t < tiles; ++t) {
+      rotated[t] = tiled->makeLeftRotation(operand[t], s);
+    }
+    auto mask = getMask(s);
+    for (std::uint32_t t = 0; t < tiles; ++t) {
+      auto &a = rotated[(t + q) % tiles];
+      auto &b = rotated[(t + q + 1) % tiles];
+      auto diff = tiled->makeTerm(Op::Sub, {a, b});
+      result[t] = tiled->makeTerm(
+          Op::Add, {b, tiled->makeTerm(Op::Mul, {diff, mask})});
+    }
+  }
+
+public:
+  VectorTiler(Program &g, std::uint32_t tileSize, std::uint32_t maskScale)
+      : program(g), tileSize(tileSize), tiles(g.getVecSize() / tileSize),
+        maskScale(maskScale),
+        tiled(std::make_unique<Program>(g.getName(), tileSize)), tile(g) {
+    for (auto &entry : g.getInputs()) {
+      inputNames.emplace(entry.second.get(), entry.first);
+    }
+    for (auto &entry : g.getOutputs()) {
+      outputNames.emplace(entry.second.get(), entry.first);
+    }
+  }
+
+  void
+  operator()(Term::Ptr &term) { // must only be used with forward pass traversal
+    auto &result = tile[term];
+    result.resize(tiles);
+    switch (term->op) {
+    case Op::Input:
+      tileInput(term, result);
+      break;
+    case Op::Output:
+      tileOutput(term, result);
+      break;
+    case Op::Constant:
+      tileConstant(term, result);
+      break;
+    case Op::RotateLeftConst:
+    case Op::RotateRightConst:
+      tileRotation(term, result);
+      break;
+    case Op::Negate:
+    case Op::Add:
+    case Op::Sub:
+    case Op::Mul:
+      for (std::uint32_t t = 0; t < tiles; ++t) {
+        std::vector<Term::Ptr> operands;
+        for (auto &operand : term->getOperands()) {
+          operands.push_back(tile[operand][t]);
+        }
+        result[t] = tiled->makeTerm(term->op, operands);
+        result[t]->assignAttributesFrom(*term);
+      }
+      break;
+    default:
+      throw std::logic_error("Unhandled op " + getOpName(term->op) +
+                             " when tiling vectors");
+    }
+  }
+
+  std::unique_ptr<Program> getTiledProgram() { return std::move(tiled); }
+};
+
+} // namespace eva
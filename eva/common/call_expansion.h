@@ -0,0 +1,117 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include "eva/common/program_traversal.h"
+#include "eva/ir/program.h"
+#include "eva/ir/term_map.h"
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace eva {
+
+/*
+Expands Call terms into copies of the terms of the functions they call, with
+the inputs of each function bound to the operands of the call. The passes
+after this one, including the rescalers and the level and scale checkers, see
+ordinary terms, so compiling takes time and memory in proportion to the
+expanded program rather than to its distinct code. Each invocation gets its own
+copy, as the levels and scales of its arguments and therefore the rescaling
+and modulus switching it needs differ from call to call.
+
+All Call terms of one invocation, one for each output of the function, share
+a single copy of its body. Calls inside a function refer to the functions of
+that function and are expanded recursively as its body is copied.
+
+Call terms are collected in a forward pass, after which expand rewrites them.
+*/
+class CallExpansion {
+  using Expansions = std::map<std::pair<std::uint32_t, std::vector<Term *>>,
+                              std::vector<Term::Ptr>>;
+
+  Program &program;
+  std::vector<Term::Ptr> calls;
+
+  // Copies the terms of function into program with its inputs bound to
+  // arguments. Returns the terms computing its outputs in the order of
+  // getOutputNames.
+  std::vector<Term::Ptr> expandBody(Program &function,
+                                    const std::vector<Term::Ptr> &arguments) {
+    std::unordered_map<Term *, std::size_t> parameters;
+    auto inputNames = function.getInputNames();
+    for (std::size_t i = 0; i < inputNames.size(); ++i) {
+      parameters.emplace(function.getInput(inputNames[i]).get(), i);
+    }
+
+    TermMap<Term::Ptr> copy(function);
+    Expansions expansions;
+    ProgramTraversal(function).forwardPass([&](Term::Ptr &term) {
+      std::vector<Term::Ptr> operands;
+      for (auto &operand : term->getOperands()) {
+        operands.push_back(copy[operand]);
+      }
+      switch (term->op) {
+      case Op::Input:
+        copy[term] = arguments.at(parameters.at(term.get()));
+        break;
+      case Op::Output:
+        copy[term] = operands[0];
+        break;
+      case Op::Call:
+        copy[term] = expandCall(function, term, operands, expansions);
+        break;
+      default:
+        copy[term] = program.makeTerm(term->op, operands);
+        copy[term]->assignAttributesFrom(*term);
+      }
+    });
+
+    std::vector<Term::Ptr> results;
+    for (auto &name : function.getOutputNames()) {
+      results.push_back(copy[function.getOutputs().at(name)]);
+    }
+    return results;
+  }
+
+  // Returns the term computing the result of call, a Call term of owner,
+  // expanding the function it calls on first use with these arguments
+  Term::Ptr expandCall(Program &owner, const Term::Ptr &call,
+                       const std::vector<Term::Ptr> &arguments,
+                       Expansions &expansions) {
+    auto index = call->get<FunctionAttribute>();
+    std::vector<Term *> key;
+    for (auto &argument : arguments) {
+      key.push_back(argument.get());
+    }
+    auto &results = expansions[{index, key}];
+    if (results.empty()) {
+      results = expandBody(owner.getFunction(index), arguments);
+    }
+    return results.at(call->get<ResultAttribute>());
+  }
+
+public:
+  CallExpansion(Program &g) : program(g) {}
+
+  void
+  operator()(Term::Ptr &term) { // must only be used with forward pass traversal
+    if (term->op == Op::Call) calls.push_back(term);
+  }
+
+  // Rewrites the Call terms found in the pass
+  void expand() {
+    Expansions expansions;
+    for (auto &call : calls) {
+      call->replaceAllUsesWith(
+          expandCall(program, call, call->getOperands(), expansions));
+    }
+    calls.clear();
+  }
+};
+
+} // namespace eva
@@ -0,0 +1,75 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include "eva/ir/program.h"
+#include "eva/ir/term_map.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace eva {
+
+/*
+Merges constants that have equal values and are encoded at the same scale, so
+that each distinct constant is stored and encoded only once. Constants are
+compared by their values expanded to the vector size of the program, so for
+example dense and sparse representations of the same vector are merged too.
+Only a hash of the values is kept for each distinct constant, and values are
+compared only between constants with equal hashes.
+*/
+class ConstantInterner {
+  struct KeyHash {
+    std::size_t
+    operator()(const std::pair<std::uint32_t, std::size_t> &key) const {
+      return key.second ^ (std::hash<std::uint32_t>()(key.first) +
+                           0x9e3779b97f4a7c15 + (key.second << 6) +
+                           (key.second >> 2));
+    }
+  };
+
+  Program &program;
+  TermMapOptional<std::uint32_t> &scale;
+  std::unordered_map<std::pair<std::uint32_t, std::size_t>,
+                     std::vector<Term::Ptr>, KeyHash>
+      interned;
+  std::vector<double> scratch;
+  std::vector<double> otherScratch;
+
+  static std::size_t hashValues(const std::vector<double> &values) {
+    std::size_t seed = values.size();
+    for (double value : values) {
+      seed ^= std::hash<double>()(value) + 0x9e3779b97f4a7c15 + (seed << 6) +
+              (seed >> 2);
+    }
+    return seed;
+  }
+
+public:
+  ConstantInterner(Program &g, TermMapOptional<std::uint32_t> &scale)
+      : program(g), scale(scale) {}
+
+  void
+  operator()(Term::Ptr &term) { // must only be used with forward pass traversal
+    if (term->op != Op::Constant) return;
+
+    auto &values = term->get<ConstantValueAttribute>()->expand(
+        scratch, program.getVecSize());
+    auto &candidates = interned[{scale[term], hashValues(values)}];
+    for (auto &candidate : candidates) {
+      auto &other = candidate->get<ConstantValueAttribute>()->expand(
+          otherScratch, program.getVecSize());
+      if (other == values) {
+        term->replaceAllUsesWith(candidate);
+        return;
+      }
+    }
+    candidates.push_back(term);
+  }
+};
+
+} // namespace eva
@@ -0,0 +1,187 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include "eva/ir/program.h"
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace eva {
+
+/*
+Lowers Permute terms into rotations and multiplications by masks. Element i of
+the result is element sources[i] of the operand, so it is found on the
+diagonal of left rotations by r = sources[i] - i (mod the vector size). The
+result is the sum over the diagonals of the operand rotated by r and masked to
+the elements on that diagonal.
+
+With d diagonals this takes d rotations. Splitting each r = g + b into a giant
+step g (a multiple of n1) and a baby step b < n1 shares the baby rotations
+between giant steps: the masks are rotated right by g at compile time, so that
+
+  result = sum_g ((sum_b (x << b) * (mask_{g+b} >> g)) << g)
+
+The number of rotations and rotation keys is then the number of distinct baby
+and giant steps, which is minimized over powers of two n1. If that is still
+more than keyBudget, the diagonals are instead reached by chains of rotations
+by powers of two, which need at most log2 of the vector size keys.
+
+All masks are multiplied in at a single depth, so the lowering consumes one
+level, or none if the permutation is a rotation. Networks like Benes'
+permutation network take fewer rotations, but need a level for each of their
+2*log2(V)-1 stages and are therefore not used. Masks are encoded at maskScale.
+
+Permute terms are collected in a forward pass, after which lower rewrites
+them. Rewriting during the pass would leave Permute terms that use another one
+unvisited.
+*/
+class PermutationLowering {
+  Program &program;
+  std::size_t keyBudget;
+  std::uint32_t maskScale;
+  std::vector<Term::Ptr> permutations;
+
+  std::size_t
+  countSteps(const std::map<std::uint32_t, std::vector<double>> &diagonals,
+             std::uint32_t n1) {
+    std::set<std::uint32_t> babySteps, giantSteps;
+    for (auto &entry : diagonals) {
+      auto baby = entry.first % n1;
+      if (baby != 0) babySteps.insert(baby);
+      if (entry.first - baby != 0) giantSteps.insert(entry.first - baby);
+    }
+    return babySteps.size() + giantSteps.size();
+  }
+
+  Term::Ptr makeMask(const std::vector<double> &mask, std::uint32_t shift) {
+    auto vecSize = mask.size();
+    std::vector<double> values(vecSize);
+    for (std::size_t i = 0; i < vecSize; ++i) {
+      values[(i + shift) % vecSize] = mask[i];
+    }
+    auto term = program.makeDenseConstant(values);
+    term->set<EncodeAtScaleAttribute>(maskScale);
+    return term;
+  }
+
+  bool isAllOnes(const std::vector<double> &mask) {
+    for (auto value : mask) {
+      if (value != 1.0) return false;
+    }
+    return true;
+  }
+
+  Term::Ptr masked(const Term::Ptr &term, const std::vector<double> &mask,
+                   std::uint32_t shift) {
+    if (isAllOnes(mask)) return term;
+    return program.makeTerm(Op::Mul, {term, makeMask(mask, shift)});
+  }
+
+  Term::Ptr accumulate(const Term::Ptr &sum, const Term::Ptr &term) {
+    return sum ? program.makeTerm(Op::Add, {sum, term}) : term;
+  }
+
+  // Rotates left by a chain of rotations by powers of two, reusing the
+  // prefixes of the chain that were already computed
+  Term::Ptr rotateByPowers(std::map<std::uint32_t, Term::Ptr> &rotated,
+                           std::uint32_t shift) {
+    auto &result = rotated[shift];
+    if (!result) {
+      auto prefix = shift & (shift - 1);
+      auto base = rotateByPowers(rotated, prefix);
+      result = program.makeLeftRotation(base, shift - prefix);
+    }
+    return result;
+  }
+
+  Term::Ptr lowerPermutation(const Term::Ptr &term) {
+    auto operand = term->operandAt(0);
+    std::uint32_t vecSize = program.getVecSize();
+    std::vector<double> scratch;
+    auto &sources =
+        term->get<PermutationAttribute>()->expand(scratch, vecSize);
+
+    std::map<std::uint32_t, std::vector<double>> diagonals;
+    for (std::uint32_t i = 0; i < vecSize; ++i) {
+      auto source = static_cast<std::uint32_t>(sources[i]);
+      auto shift = (source + vecSize - i) % vecSize;
+      auto &mask = diagonals[shift];
+      mask.resize(vecSize);
+      mask[i] = 1.0;
+    }
+
+    std::uint32_t bestN1 = 1;
+    auto bestSteps = countSteps(diagonals, 1);
+    for (std::uint32_t n1 = 2; n1 < vecSize; n1 *= 2) {
+      auto steps = countSteps(diagonals, n1);
+      if (steps < bestSteps) {
+        bestSteps = steps;
+        bestN1 = n1;
+      }
+    }
+
+    Term::Ptr result;
+    if (keyBudget != 0 && bestSteps > keyBudget) {
+      std::uint32_t powers = 0;
+      for (auto &entry : diagonals) powers |= entry.first;
+      std::size_t keys = 0;
+      for (; powers != 0; powers &= powers - 1) ++keys;
+      if (keys > keyBudget) {
+        throw std::runtime_error(
+            "Permutation needs at least " + std::to_string(keys) +
+            " rotation keys, but the budget is " + std::to_string(keyBudget));
+      }
+      std::map<std::uint32_t, Term::Ptr> rotated{{0, operand}};
+      for (auto &entry : diagonals) {
+        auto value = rotateByPowers(rotated, entry.first);
+        result = accumulate(result, masked(value, entry.second, 0));
+      }
+      return result;
+    }
+
+    std::map<std::uint32_t, Term::Ptr> babySteps{{0, operand}};
+    std::map<std::uint32_t, Term::Ptr> giantSteps;
+    for (auto &entry : diagonals) {
+      auto baby = entry.first % bestN1;
+      auto giant = entry.first - baby;
+      auto &rotated = babySteps[baby];
+      if (!rotated) rotated = program.makeLeftRotation(operand, baby);
+      giantSteps[giant] = accumulate(
+          giantSteps[giant], masked(rotated, entry.second, giant));
+    }
+    for (auto &entry : giantSteps) {
+      auto value = entry.second;
+      if (entry.first != 0) {
+        value = program.makeLeftRotation(value, entry.first);
+      }
+      result = accumulate(result, value);
+    }
+    return result;
+  }
+
+public:
+  PermutationLowering(Program &g, std::size_t keyBudget,
+                      std::uint32_t maskScale)
+      : program(g), keyBudget(keyBudget), maskScale(maskScale) {}
+
+  void
+  operator()(Term::Ptr &term) { // must only be used with forward pass traversal
+    if (term->op == Op::Permute) permutations.push_back(term);
+  }
+
+  // Rewrites the Permute terms found in the pass
+  void lower() {
+    for (auto &term : permutations) {
+      term->replaceAllUsesWith(lowerPermutation(term));
+    }
+    permutations.clear();
+  }
+};
+
+} // namespace eva
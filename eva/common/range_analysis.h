@@ -0,0 +1,123 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include "eva/ir/program.h"
+#include "eva/ir/term_map.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace eva {
+
+/*
+Computes an interval bounding the values of every term, seeded by the bounds of
+inputs. An input with a RangeAttribute of b bits is assumed to only take
+values in [-2^b, 2^b], while inputs without one are unbounded. Constants are
+bounded by their actual values. The bounds hold across all slots, so rotations
+preserve them.
+
+After a forward pass, getRange gives the number of bits sufficient for the
+output to use as its RangeAttribute, or 0 if the output depends on an
+unbounded input.
+*/
+class RangeAnalysis {
+  struct Interval {
+    double lo = -std::numeric_limits<double>::infinity();
+    double hi = std::numeric_limits<double>::infinity();
+
+    double magnitude() const { return std::max(std::abs(lo), std::abs(hi)); }
+  };
+
+  Program &program;
+  TermMap<Interval> interval;
+  std::vector<double> scratch;
+
+  Interval add(const Interval &a, const Interval &b) {
+    return {a.lo + b.lo, a.hi + b.hi};
+  }
+
+  Interval sub(const Interval &a, const Interval &b) {
+    return {a.lo - b.hi, a.hi - b.lo};
+  }
+
+  Interval mul(const Interval &a, const Interval &b) {
+    if (std::isinf(a.magnitude()) || std::isinf(b.magnitude())) {
+      return {};
+    }
+    double products[] = {a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi};
+    return {*std::min_element(std::begin(products), std::end(products)),
+            *std::max_element(std::begin(products), std::end(products))};
+  }
+
+  Interval square(const Interval &a) {
+    auto squared = mul(a, a);
+    if (a.lo <= 0 && a.hi >= 0) {
+      squared.lo = 0;
+    } else {
+      squared.lo = std::min(a.lo * a.lo, a.hi * a.hi);
+    }
+    return squared;
+  }
+
+public:
+  RangeAnalysis(Program &g) : program(g), interval(g) {}
+
+  void
+  operator()(Term::Ptr &term) { // must only be used with forward pass traversal
+    auto &result = interval[term];
+    auto &operands = term->getOperands();
+    switch (term->op) {
+    case Op::Input:
+      if (term->has<RangeAttribute>()) {
+        auto bound = std::ldexp(1.0, term->get<RangeAttribute>());
+        result = {-bound, bound};
+      }
+      break;
+    case Op::Constant: {
+      auto &values = term->get<ConstantValueAttribute>()->expand(
+          scratch, program.getVecSize());
+      auto minmax = std::minmax_element(values.begin(), values.end());
+      result = {*minmax.first, *minmax.second};
+      break;
+    }
+    case Op::Negate:
+      result = {-interval[operands[0]].hi, -interval[operands[0]].lo};
+      break;
+    case Op::Add:
+      result = add(interval[operands[0]], interval[operands[1]]);
+      break;
+    case Op::Sub:
+      if (operands[0] == operands[1]) {
+        result = {0, 0};
+      } else {
+        result = sub(interval[operands[0]], interval[operands[1]]);
+      }
+      break;
+    case Op::Mul:
+      if (operands[0] == operands[1]) {
+        result = square(interval[operands[0]]);
+      } else {
+        result = mul(interval[operands[0]], interval[operands[1]]);
+      }
+      break;
+    default:
+      // Remaining ops do not change the values of any slot, only their order
+      // or representation
+      if (operands.size() > 0) result = interval[operands[0]];
+      break;
+    }
+  }
+
+  std::uint32_t getRange(const Term::Ptr &term) {
+    auto magnitude = interval[term].magnitude();
+    if (std::isinf(magnitude) || std::isnan(magnitude)) return 0;
+    // One extra bit is reserved for the sign of the value
+    return static_cast<std::uint32_t>(std::ceil(std::log2(magnitude + 1))) + 1;
+  }
+};
+
+} // namespace eva
@@ -5,7 +5,10 @@
 
 #include "eva/ir/program.h"
 #include "eva/ir/term_map.h"
-#include <numeric>
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <tuple>
 
 namespace eva {
 
@@ -57,20 +60,79 @@ public:
   }
 };
 
+/*
+This pass expands the flat reductions produced by ReductionCombiner back into
+binary terms. The tree is built Huffman-style: the two operands that are
+cheapest to combine are repeatedly replaced by their combination until only
+two remain. Unencrypted operands always go first, so that they are combined
+with each other and enter the encrypted part of the reduction as a single
+value that is encoded once. Encrypted operands are then ordered by their
+estimated multiplicative depth, and by scale between operands of the same
+depth.
+
+For example, with a at depth 2 and b, c and d at depth 0,
+(a * b * c * d) => a * ((b * c) * d), which has depth 3, while the balanced
+tree (a * b) * (c * d) would have depth 4.
+*/
 class ReductionLogExpander {
+  // Operands are combined in increasing order of (unencrypted first,
+  // depth, scale, creation order)
+  using Priority =
+      std::tuple<bool, std::uint32_t, std::uint32_t, std::uint64_t>;
+
   Program &program;
   TermMap<Type> &type;
-  TermMapOptional<int> scale;
-  std::vector<Term::Ptr> operands, nextOperands;
-  std::map<std::uint32_t, std::vector<Term::Ptr>> sortedOperands;
+  TermMapOptional<std::uint32_t> scale;
+  TermMap<std::uint32_t> depth;
+  std::map<Priority, Term::Ptr> queue;
+  std::uint64_t queued = 0;
 
   bool isReductionOp(const Op &op_code) {
     return ((op_code == Op::Add) || (op_code == Op::Mul));
   }
 
+  void push(const Term::Ptr &term) {
+    queue.emplace(Priority(type[term] == Type::Cipher, depth[term],
+                           scale.at(term), queued++),
+                  term);
+  }
+
+  Term::Ptr pop() {
+    auto term = queue.begin()->second;
+    queue.erase(queue.begin());
+    return term;
+  }
+
+  // Calculate the scales that we would get without any rescaling, along with
+  // the number of rescalings a typical rescaling policy would need. Terms at a
+  // similar scale will likely end up having the same level, which helps
+  // grouping terms of the same level together.
+  void estimate(const Term::Ptr &term) {
+    auto &operands = term->getOperands();
+    if (operands.size() == 0) {
+      scale[term] = term->get<EncodeAtScaleAttribute>();
+      depth[term] = 0;
+      return;
+    }
+    std::uint32_t maxScale = 0, sumScale = 0, maxDepth = 0;
+    for (auto &operand : operands) {
+      maxScale = std::max(maxScale, scale.at(operand));
+      sumScale += scale.at(operand);
+      maxDepth = std::max(maxDepth, depth[operand]);
+    }
+    if (term->op == Op::Mul) {
+      scale[term] = sumScale;
+      // Only encrypted multiplications consume a level
+      depth[term] = maxDepth + (type[term] == Type::Cipher ? 1 : 0);
+    } else {
+      scale[term] = maxScale;
+      depth[term] = maxDepth;
+    }
+  }
+
 public:
   ReductionLogExpander(Program &g, TermMap<Type> &type)
-      : program(g), type(type), scale(g) {}
+      : program(g), type(type), scale(g), depth(g) {}
 
   void operator()(Term::Ptr &term) {
     if (term->op == Op::Rescale || term->op == Op::ModSwitch) {
@@ -80,68 +142,30 @@ public:
                              "been performed yet.");
     }
 
-    // Calculate the scales that we would get without any rescaling. Terms at a
-    // similar scale will likely end up having the same level in typical
-    // rescaling policies, which helps the sorting group terms of the same level
-    // together.
-    if (term->numOperands() == 0) {
-      scale[term] = term->get<EncodeAtScaleAttribute>();
-    } else if (term->op == Op::Mul) {
-      scale[term] = std::accumulate(
-          term->getOperands().begin(), term->getOperands().end(), 0,
-          [&](auto &sum, auto &operand) { return sum + scale.at(operand); });
-    } else {
-      scale[term] = std::accumulate(term->getOperands().begin(),
-                                    term->getOperands().end(), 0,
-                                    [&](auto &max, auto &operand) {
-                                      return std::max(max, scale.at(operand));
-                                    });
-    }
-
     if (isReductionOp(term->op) && term->numOperands() > 2) {
-      // We sort operands into constants, plaintext and raw, then ciphertexts by
-      // scale. This helps avoid unnecessary accumulation of scale.
       for (auto &operand : term->getOperands()) {
-        auto order = 0;
-        if (type[operand] == Type::Plain || type[operand] == Type::Raw) {
-          order = 1;
-        } else if (type[operand] == Type::Cipher) {
-          order = 2 + scale.at(operand);
-        }
-        sortedOperands[order].push_back(operand);
-      }
-      for (auto &op : sortedOperands) {
-        operands.insert(operands.end(), op.second.begin(), op.second.end());
+        push(operand);
       }
 
-      // Expand the sorted operands into a balanced reduction tree by pairing
-      // adjacent operands until only one remains.
-      assert(operands.size() >= 2);
-      while (operands.size() > 2) {
-        std::size_t i = 0;
-        while ((i + 1) < operands.size()) {
-          auto &leftOperand = operands[i];
-          auto &rightOperand = operands[i + 1];
-          auto newTerm =
-              program.makeTerm(term->op, {leftOperand, rightOperand});
-          nextOperands.push_back(newTerm);
-          i += 2;
-        }
-        if (i < operands.size()) {
-          assert((i + 1) == operands.size());
-          nextOperands.push_back(operands[i]);
-        }
-        operands = nextOperands;
-        nextOperands.clear();
+      while (queue.size() > 2) {
+        auto leftOperand = pop();
+        auto rightOperand = pop();
+        auto newTerm = program.makeTerm(term->op, {leftOperand, rightOperand});
+        type[newTerm] = (type[leftOperand] == Type::Cipher ||
+                         type[rightOperand] == Type::Cipher)
+                            ? Type::Cipher
+                            : type[leftOperand];
+        estimate(newTerm);
+        push(newTerm);
       }
 
-      assert(operands.size() == 2);
-      term->setOperands(operands);
-
-      operands.clear();
-      nextOperands.clear();
-      sortedOperands.clear();
+      assert(queue.size() == 2);
+      auto leftOperand = pop();
+      auto rightOperand = pop();
+      term->setOperands({leftOperand, rightOperand});
     }
+
+    estimate(term);
   }
 };
 
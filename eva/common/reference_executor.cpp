@@ -2,6 +2,7 @@
 // Licensed under the MIT license.
 
 #include "eva/common/reference_executor.h"
+#include "eva/common/program_traversal.h"
 #include <algorithm>
 #include <cassert>
 #include <functional>
@@ -57,6 +58,50 @@ void ReferenceExecutor::negate(vector<double> &output, const Term::Ptr &args) {
             std::negate<double>());
 }
 
+void ReferenceExecutor::permute(vector<double> &output, const Term::Ptr &args,
+                                const ConstantValue &sources) {
+  auto &input = terms_.at(args);
+
+  // Expand the sources to the number of slots
+  vector<double> scratch;
+  auto &indices = sources.expand(scratch, vecSize_);
+
+  // Gather the elements of the input
+  output.clear();
+  output.reserve(vecSize_);
+  for (auto index : indices) {
+    output.push_back(input.at(static_cast<size_t>(index) % input.size()));
+  }
+}
+
+void ReferenceExecutor::call(vector<double> &output, const Term::Ptr &term) {
+  auto index = term->get<FunctionAttribute>();
+  auto args = term->getOperands();
+  vector<Term *> key;
+  for (auto &arg : args) {
+    key.push_back(arg.get());
+  }
+
+  // Evaluate the function once for all Call terms of the same invocation
+  auto &results = calls_[{index, key}];
+  if (results.empty()) {
+    auto &function = program_.getFunction(index);
+    Valuation inputs, outputs;
+    auto inputNames = function.getInputNames();
+    for (size_t i = 0; i < inputNames.size(); ++i) {
+      inputs[inputNames[i]] = terms_.at(args[i]);
+    }
+    ReferenceExecutor executor(function);
+    executor.setInputs(inputs);
+    ProgramTraversal(function).forwardPass(executor);
+    executor.getOutputs(outputs);
+    for (auto &name : function.getOutputNames()) {
+      results.push_back(move(outputs.at(name)));
+    }
+  }
+  output = results.at(term->get<ResultAttribute>());
+}
+
 void ReferenceExecutor::operator()(const Term::Ptr &term) {
   // Must only be used with forward pass traversal
   auto &output = terms_[term];
@@ -96,6 +141,13 @@ void ReferenceExecutor::operator()(const Term::Ptr &term) {
     assert(args.size() == 1);
     negate(output, args[0]);
     break;
+  case Op::Permute:
+    assert(args.size() == 1);
+    permute(output, args[0], *term->get<PermutationAttribute>());
+    break;
+  case Op::Call:
+    call(output, term);
+    break;
   case Op::Encode:
     [[fallthrough]];
   case Op::Output:
@@ -7,8 +7,10 @@
 #include "eva/ir/program.h"
 #include "eva/ir/term_map.h"
 #include <cstdint>
+#include <map>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace eva {
@@ -55,6 +57,10 @@ private:
   Program &program_;
   std::uint64_t vecSize_;
   TermMapOptional<std::vector<double>> terms_;
+  // Outputs of the functions already called, by function and arguments
+  std::map<std::pair<std::uint32_t, std::vector<Term *>>,
+           std::vector<std::vector<double>>>
+      calls_;
 
   template <class Op>
   void binOp(std::vector<double> &out, const Term::Ptr &args1,
@@ -75,6 +81,11 @@ private:
                    std::int32_t shift);
 
   void negate(std::vector<double> &output, const Term::Ptr &args);
+
+  void permute(std::vector<double> &output, const Term::Ptr &args,
+               const ConstantValue &sources);
+
+  void call(std::vector<double> &output, const Term::Ptr &term);
 };
 
 } // namespace eva
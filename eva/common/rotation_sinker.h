@@ -0,0 +1,122 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include "eva/ir/program.h"
+#include "eva/ir/term_map.h"
+#include <cstdint>
+#include <vector>
+
+namespace eva {
+
+/*
+Moves ciphertext rotations below element-wise operations so that they are
+performed on the result instead of on an operand. Two cases are handled:
+
+  rot(x, r) op c          -> rot(x op rot(c, -r), r)  for a constant c
+  rot(x, r) op rot(y, r)  -> rot(x op y, r)
+
+where op is one of Add, Sub or Mul. Since a program vector is replicated
+across all slots, rotating the compile-time constant by the inverse amount
+within vecSize preserves semantics. Moving a rotation past a multiplication
+lets the rescale following the multiplication happen before the rotation,
+which in turn allows the key switch to happen at a lower level (see
+KeySwitchSinker). The second case additionally removes one rotation.
+
+Only rotations whose sole use is the rewritten term are moved. The rewrite is
+performed by rewiring the existing terms, so repeated application moves a
+rotation down through a whole chain of such operations.
+*/
+class RotationSinker {
+  Program &program;
+  TermMap<Type> &type;
+  TermMapOptional<std::uint32_t> &scale;
+
+  bool isRotationOp(const Op &op_code) {
+    return ((op_code == Op::RotateLeftConst) ||
+            (op_code == Op::RotateRightConst));
+  }
+
+  bool isElementwiseBinaryOp(const Op &op_code) {
+    return ((op_code == Op::Add) || (op_code == Op::Sub) ||
+            (op_code == Op::Mul));
+  }
+
+  bool isSinkableRotation(Term::Ptr &term) {
+    return isRotationOp(term->op) && type[term] == Type::Cipher &&
+           term->numUses() == 1;
+  }
+
+  // Rotation amount normalized to a left rotation in [0, vecSize)
+  std::uint32_t leftRotation(Term::Ptr &rotation) {
+    auto vecSize = static_cast<std::int64_t>(program.getVecSize());
+    std::int64_t shift = rotation->get<RotationAttribute>();
+    if (rotation->op == Op::RotateRightConst) shift = -shift;
+    shift %= vecSize;
+    if (shift < 0) shift += vecSize;
+    return static_cast<std::uint32_t>(shift);
+  }
+
+  Term::Ptr makeRotatedConstant(Term::Ptr &constant, std::uint32_t shift) {
+    auto vecSize = program.getVecSize();
+    std::vector<double> scratch;
+    auto &values = constant->get<ConstantValueAttribute>()->expand(
+        scratch, vecSize);
+    // Rotating right by shift undoes a left rotation by shift
+    std::vector<double> rotated(vecSize);
+    for (std::size_t i = 0; i < vecSize; ++i) {
+      rotated[(i + shift) % vecSize] = values[i];
+    }
+    if (rotated == values) return constant;
+    auto newConstant = program.makeDenseConstant(rotated);
+    newConstant->set<EncodeAtScaleAttribute>(
+        constant->get<EncodeAtScaleAttribute>());
+    type[newConstant] = type[constant];
+    scale[newConstant] = scale[constant];
+    return newConstant;
+  }
+
+  // Rewires rotation -> term into term -> rotation. The operands of term must
+  // have been updated by the caller.
+  void swapWithRotation(Term::Ptr &term, Term::Ptr rotation,
+                        std::vector<Term::Ptr> newOperands) {
+    term->replaceAllUsesWith(rotation);
+    term->setOperands(std::move(newOperands));
+    rotation->setOperands({term});
+  }
+
+public:
+  RotationSinker(Program &g, TermMap<Type> &type,
+                 TermMapOptional<std::uint32_t> &scale)
+      : program(g), type(type), scale(scale) {}
+
+  void
+  operator()(Term::Ptr &term) { // must only be used with forward pass traversal
+    if (!isElementwiseBinaryOp(term->op)) return;
+    if (type[term] != Type::Cipher) return;
+    assert(term->numOperands() == 2);
+
+    auto left = term->operandAt(0);
+    auto right = term->operandAt(1);
+    bool leftRotated = isSinkableRotation(left);
+    bool rightRotated = isSinkableRotation(right);
+
+    if (leftRotated && rightRotated) {
+      if (left->op != right->op ||
+          left->get<RotationAttribute>() != right->get<RotationAttribute>()) {
+        return;
+      }
+      swapWithRotation(term, left,
+                       {left->operandAt(0), right->operandAt(0)});
+    } else if (leftRotated && right->op == Op::Constant) {
+      auto constant = makeRotatedConstant(right, leftRotation(left));
+      swapWithRotation(term, left, {left->operandAt(0), constant});
+    } else if (rightRotated && left->op == Op::Constant) {
+      auto constant = makeRotatedConstant(left, leftRotation(right));
+      swapWithRotation(term, right, {constant, right->operandAt(0)});
+    }
+  }
+};
+
+} // namespace eva
@@ -0,0 +1,272 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include "eva/ir/program.h"
+#include "eva/ir/term_map.h"
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <tuple>
+#include <vector>
+
+namespace eva {
+
+/*
+Reduces the multiplicative depth of mixed expressions of additions,
+subtractions, multiplications and negations by applying distributivity and
+associativity. For example, in
+
+  a * (b * (c + d * (e * f)))
+
+the multiplication by a is at depth 4. Distributing gives the sum of products
+
+  a * b * c + a * b * d * e * f
+
+which is rebuilt with each product and the sum combining their shallowest
+operands first, resulting in depth 3.
+
+Expressions are trees of encrypted terms that have a single use, so no work is
+duplicated by rewriting them. A tree is only rewritten when that reduces its
+depth, the sum of products has at most maxProducts terms and the number of
+multiplications grows by at most a factor of maxMulGrowth. Depths are
+estimated by counting encrypted multiplications.
+
+These limits confine the rewrite to small expressions such as the one above.
+For example, a polynomial of degree n in Horner form has n multiplications,
+while its expansion has n(n+1)/2, so only polynomials up to degree 3 are
+rewritten. Those drop from depth 3 to 2, and higher degrees are left alone.
+
+As rewriting a tree replaces its root with a new term, which ProgramTraversal
+does not support, the trees are collected during the forward pass and
+rewritten when the pass is destroyed.
+*/
+class TreeHeightReducer {
+  struct Product {
+    bool negative;
+    std::vector<Term::Ptr> factors;
+  };
+
+  static const std::size_t maxProducts = 16;
+  static const std::size_t maxMulGrowth = 2;
+
+  Program &program;
+  TermMap<Type> &type;
+  TermMap<std::uint32_t> depth;
+  std::vector<Term::Ptr> roots;
+  std::uint64_t created = 0;
+
+  bool isArithmeticOp(const Op &op_code) {
+    return ((op_code == Op::Add) || (op_code == Op::Sub) ||
+            (op_code == Op::Mul) || (op_code == Op::Negate));
+  }
+
+  bool isInnerNode(const Term::Ptr &term) {
+    if (!isArithmeticOp(term->op) || type[term] != Type::Cipher ||
+        term->numUses() != 1) {
+      return false;
+    }
+    return isArithmeticOp(term->getUses()[0]->op);
+  }
+
+  void estimateDepth(const Term::Ptr &term) {
+    std::uint32_t maxDepth = 0;
+    for (auto &operand : term->getOperands()) {
+      maxDepth = std::max(maxDepth, depth[operand]);
+    }
+    // Only encrypted multiplications consume a level
+    if (term->op == Op::Mul && type[term] == Type::Cipher) ++maxDepth;
+    depth[term] = maxDepth;
+  }
+
+  // Depth of the tree rooted at term given the current depths of its leaves
+  std::uint32_t treeDepth(const Term::Ptr &term, bool isRoot) {
+    if (!isRoot && !isInnerNode(term)) return depth[term];
+    std::uint32_t maxDepth = 0;
+    for (auto &operand : term->getOperands()) {
+      maxDepth = std::max(maxDepth, treeDepth(operand, false));
+    }
+    if (term->op == Op::Mul) ++maxDepth;
+    return maxDepth;
+  }
+
+  std::size_t countMuls(const Term::Ptr &term, bool isRoot) {
+    if (!isRoot && !isInnerNode(term)) return 0;
+    std::size_t count = term->op == Op::Mul ? 1 : 0;
+    for (auto &operand : term->getOperands()) {
+      count += countMuls(operand, false);
+    }
+    return count;
+  }
+
+  // Expands the tree rooted at term into a sum of products. Returns an empty
+  // vector if the sum would have more than maxProducts terms.
+  std::vector<Product> expand(const Term::Ptr &term, bool isRoot) {
+    if (!isRoot && !isInnerNode(term)) return {{false, {term}}};
+
+    auto &operands = term->getOperands();
+    auto left = expand(operands[0], false);
+    if (left.empty() || term->op == Op::Negate) {
+      for (auto &product : left) {
+        product.negative = !product.negative;
+      }
+      return left;
+    }
+    auto right = expand(operands[1], false);
+    if (right.empty()) return {};
+
+    std::vector<Product> result;
+    if (term->op == Op::Mul) {
+      if (left.size() * right.size() > maxProducts) return {};
+      for (auto &l : left) {
+        for (auto &r : right) {
+          Product product{l.negative != r.negative, l.factors};
+          product.factors.insert(product.factors.end(), r.factors.begin(),
+                                 r.factors.end());
+          result.push_back(std::move(product));
+        }
+      }
+    } else {
+      if (left.size() + right.size() > maxProducts) return {};
+      result = std::move(left);
+      for (auto &r : right) {
+        if (term->op == Op::Sub) r.negative = !r.negative;
+        result.push_back(std::move(r));
+      }
+    }
+    return result;
+  }
+
+  std::uint32_t productDepth(const Product &product) {
+    // Unencrypted factors are multiplied together first and then act like a
+    // single factor at depth 0
+    std::vector<std::uint32_t> depths;
+    bool hasUnencrypted = false;
+    for (auto &factor : product.factors) {
+      if (type[factor] == Type::Cipher) {
+        depths.push_back(depth[factor]);
+      } else {
+        hasUnencrypted = true;
+      }
+    }
+    if (depths.empty()) return 0;
+    if (hasUnencrypted) depths.push_back(0);
+    std::sort(depths.begin(), depths.end(), std::greater<std::uint32_t>());
+    while (depths.size() > 1) {
+      auto combined = std::max(depths[depths.size() - 1],
+                               depths[depths.size() - 2]) +
+                      1;
+      depths.pop_back();
+      depths.back() = combined;
+      std::sort(depths.begin(), depths.end(), std::greater<std::uint32_t>());
+    }
+    return depths[0];
+  }
+
+  Term::Ptr makeTerm(Op op, const std::vector<Term::Ptr> &operands) {
+    auto term = program.makeTerm(op, operands);
+    type[term] = Type::Raw;
+    for (auto &operand : operands) {
+      if (type[operand] == Type::Cipher) type[term] = Type::Cipher;
+    }
+    estimateDepth(term);
+    return term;
+  }
+
+  Term::Ptr buildProduct(const Product &product) {
+    // Combine the shallowest factors first, with unencrypted ones before any
+    // encrypted ones
+    std::map<std::tuple<bool, std::uint32_t, std::uint64_t>, Term::Ptr> queue;
+    for (auto &factor : product.factors) {
+      queue.emplace(std::make_tuple(type[factor] == Type::Cipher,
+                                    depth[factor], created++),
+                    factor);
+    }
+    while (queue.size() > 1) {
+      auto left = queue.begin()->second;
+      queue.erase(queue.begin());
+      auto right = queue.begin()->second;
+      queue.erase(queue.begin());
+      auto newTerm = makeTerm(Op::Mul, {left, right});
+      queue.emplace(std::make_tuple(type[newTerm] == Type::Cipher,
+                                    depth[newTerm], created++),
+                    newTerm);
+    }
+    return queue.begin()->second;
+  }
+
+  Term::Ptr buildSum(const std::vector<Product> &products) {
+    // Combine the shallowest products first while tracking signs, so that at
+    // most one negation is needed at the end
+    std::map<std::tuple<std::uint32_t, std::uint64_t>,
+             std::pair<bool, Term::Ptr>>
+        queue;
+    for (auto &product : products) {
+      auto term = buildProduct(product);
+      queue.emplace(std::make_tuple(depth[term], created++),
+                    std::make_pair(product.negative, term));
+    }
+    while (queue.size() > 1) {
+      auto left = queue.begin()->second;
+      queue.erase(queue.begin());
+      auto right = queue.begin()->second;
+      queue.erase(queue.begin());
+      bool negative = false;
+      Term::Ptr newTerm;
+      if (left.first == right.first) {
+        negative = left.first;
+        newTerm = makeTerm(Op::Add, {left.second, right.second});
+      } else if (right.first) {
+        newTerm = makeTerm(Op::Sub, {left.second, right.second});
+      } else {
+        newTerm = makeTerm(Op::Sub, {right.second, left.second});
+      }
+      queue.emplace(std::make_tuple(depth[newTerm], created++),
+                    std::make_pair(negative, newTerm));
+    }
+    auto result = queue.begin()->second;
+    if (result.first) return makeTerm(Op::Negate, {result.second});
+    return result.second;
+  }
+
+  void reduce(const Term::Ptr &root) {
+    auto products = expand(root, true);
+    if (products.empty()) return;
+
+    std::uint32_t newDepth = 0;
+    std::size_t newMuls = 0;
+    for (auto &product : products) {
+      newDepth = std::max(newDepth, productDepth(product));
+      newMuls += product.factors.size() - 1;
+    }
+    if (newDepth >= treeDepth(root, true)) return;
+    if (newMuls > maxMulGrowth * countMuls(root, true)) return;
+
+    auto newRoot = buildSum(products);
+    root->replaceAllUsesWith(newRoot);
+  }
+
+public:
+  TreeHeightReducer(Program &g, TermMap<Type> &type)
+      : program(g), type(type), depth(g) {}
+
+  ~TreeHeightReducer() {
+    // Roots were collected in topological order, so the depths of the leaves
+    // of each tree are up to date when it is rewritten.
+    for (auto &root : roots) {
+      if (root->numUses() > 0) reduce(root);
+    }
+  }
+
+  void
+  operator()(Term::Ptr &term) { // must only be used with forward pass traversal
+    estimateDepth(term);
+    if (isArithmeticOp(term->op) && type[term] == Type::Cipher &&
+        !isInnerNode(term)) {
+      roots.push_back(term);
+    }
+  }
+};
+
+} // namespace eva
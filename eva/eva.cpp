@@ -20,4 +20,32 @@ Valuation evaluate(Program &program, const Valuation &inputs) {
   return outputs;
 }
 
+std::unique_ptr<Program> specialize(Program &program,
+                                    const Valuation &inputs) {
+  auto specialized = program.deepCopy();
+  for (auto &entry : inputs) {
+    auto &name = entry.first;
+    auto &values = entry.second;
+    auto input = specialized->getInput(name);
+    if (input->get<TypeAttribute>() == Type::Cipher) {
+      throw std::runtime_error("Cannot bind encrypted input " + name +
+                               " to a value");
+    }
+    if (values.empty() || specialized->getVecSize() % values.size() != 0) {
+      throw std::runtime_error("Value for input " + name +
+                               " must have a size that divides the vector "
+                               "size of the program");
+    }
+
+    auto constant = specialized->makeDenseConstant(values);
+    if (input->has<EncodeAtScaleAttribute>()) {
+      constant->set<EncodeAtScaleAttribute>(
+          input->get<EncodeAtScaleAttribute>());
+    }
+    input->replaceAllUsesWith(constant);
+    specialized->removeInput(name);
+  }
+  return specialized;
+}
+
 } // namespace eva
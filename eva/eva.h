@@ -6,6 +6,8 @@
 #include "eva/ckks/ckks_compiler.h"
 #include "eva/ir/program.h"
 #include "eva/seal/seal.h"
+#include "eva/seal/seal_bundle.h"
+#include "eva/serialization/flat_program.h"
 #include "eva/serialization/save_load.h"
 #include "eva/version.h"
 
@@ -13,4 +15,8 @@ namespace eva {
 
 Valuation evaluate(Program &program, const Valuation &inputs);
 
+// Returns a copy of the program with the given unencrypted inputs bound to
+// constants, so that compiling it folds them into the rest of the program.
+std::unique_ptr<Program> specialize(Program &program, const Valuation &inputs);
+
 }
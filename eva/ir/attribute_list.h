@@ -13,6 +13,7 @@
 #include <memory>
 #include <utility>
 #include <variant>
+#include <vector>
 
 namespace eva {
 
@@ -48,6 +49,11 @@ public:
   // This function is defined in eva/serialization/eva_serialization.cpp
   void loadAttribute(const msg::Attribute &msg);
 
+  // As above, resolving constants shared through the program (see eva.proto)
+  void loadAttribute(
+      const msg::Attribute &msg,
+      const std::vector<std::shared_ptr<ConstantValue>> &constants);
+
   // This function is defined in eva/serialization/eva_serialization.cpp
   void serializeAttributes(std::function<msg::Attribute *()> addMsg) const;
 
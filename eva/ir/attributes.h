@@ -16,7 +16,10 @@ namespace eva {
   X(TypeAttribute, Type)                                                       \
   X(RangeAttribute, std::uint32_t)                                             \
   X(EncodeAtScaleAttribute, std::uint32_t)                                     \
-  X(EncodeAtLevelAttribute, std::uint32_t)
+  X(EncodeAtLevelAttribute, std::uint32_t)                                     \
+  X(PermutationAttribute, std::shared_ptr<ConstantValue>)                      \
+  X(FunctionAttribute, std::uint32_t)                                          \
+  X(ResultAttribute, std::uint32_t)
 
 namespace detail {
 enum AttributeIndex {
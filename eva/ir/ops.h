@@ -19,6 +19,8 @@ namespace eva {
   X(Mul, 13)                                                                   \
   X(RotateLeftConst, 14)                                                       \
   X(RotateRightConst, 15)                                                      \
+  X(Permute, 16)                                                               \
+  X(Call, 17)                                                                  \
   X(Relinearize, 20)                                                           \
   X(ModSwitch, 21)                                                             \
   X(Rescale, 22)                                                               \
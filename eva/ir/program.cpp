@@ -5,6 +5,7 @@
 #include "eva/common/program_traversal.h"
 #include "eva/ir/term_map.h"
 #include "eva/util/logging.h"
+#include <algorithm>
 #include <stack>
 
 using namespace std;
@@ -45,9 +46,68 @@ std::unique_ptr<Program> Program::deepCopy() {
   for (auto &entry : outputs) {
     newProg->outputs[entry.first] = oldToNew[entry.second];
   }
+  for (auto &function : functions) {
+    newProg->functions.emplace_back(function->deepCopy());
+  }
   return newProg;
 }
 
+uint32_t Program::addFunction(Program &function) {
+  if (function.getVecSize() != vecSize) {
+    throw runtime_error("Function " + function.getName() +
+                        " must have the same vector size as program " +
+                        getName());
+  }
+  functions.emplace_back(function.deepCopy());
+  return static_cast<uint32_t>(functions.size() - 1);
+}
+
+unordered_map<string, Term::Ptr>
+Program::makeCall(uint32_t index,
+                  const unordered_map<string, Term::Ptr> &arguments) {
+  auto &function = getFunction(index);
+  vector<Term::Ptr> operands;
+  for (auto &name : function.getInputNames()) {
+    auto argument = arguments.find(name);
+    if (argument == arguments.end()) {
+      throw runtime_error("No argument for input " + name + " of function " +
+                          function.getName());
+    }
+    operands.push_back(argument->second);
+  }
+  if (arguments.size() != operands.size()) {
+    throw runtime_error("Function " + function.getName() +
+                        " has no input for some of the arguments");
+  }
+
+  unordered_map<string, Term::Ptr> results;
+  uint32_t result = 0;
+  for (auto &name : function.getOutputNames()) {
+    auto call = makeTerm(Op::Call, operands);
+    call->set<FunctionAttribute>(index);
+    call->set<ResultAttribute>(result++);
+    results.emplace(name, call);
+  }
+  return results;
+}
+
+template <class Map> vector<string> getSortedNames(const Map &map) {
+  vector<string> names;
+  for (auto &entry : map) {
+    names.push_back(entry.first);
+  }
+  sort(names.begin(), names.end());
+  return names;
+}
+
+vector<string> Program::getInputNames() const {
+  return getSortedNames(inputs);
+}
+
+vector<string> Program::getOutputNames() const {
+  return getSortedNames(outputs);
+}
+
 uint64_t Program::allocateIndex() {
   // TODO: reuse released indices to save space in TermMap instances
   uint64_t index = nextTermIndex++;
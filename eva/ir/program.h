@@ -20,6 +20,7 @@ namespace eva {
 template <typename> class TermMapOptional;
 template <typename> class TermMap;
 class TermMapBase;
+struct ConstantEncoding;
 
 class Program {
 public:
@@ -84,12 +85,58 @@ public:
     return rotation;
   }
 
+  // Makes a term whose element i is element sources[i] of term. The sources
+  // are held as a constant value.
+  Term::Ptr makePermutation(const Term::Ptr &term,
+                            const std::vector<std::uint32_t> &sources) {
+    if (sources.size() != vecSize) {
+      throw std::runtime_error(
+          "Permutation must have a source for each element of the vector");
+    }
+    std::vector<double> values;
+    for (auto source : sources) {
+      if (source >= vecSize) {
+        throw std::runtime_error("Permutation source " +
+                                 std::to_string(source) + " is out of range");
+      }
+      values.push_back(source);
+    }
+    auto permutation = makeTerm(Op::Permute, {term});
+    permutation->set<PermutationAttribute>(
+        std::make_shared<DenseConstantValue>(vecSize, values));
+    return permutation;
+  }
+
   Term::Ptr makeRescale(const Term::Ptr &term, std::uint32_t rescaleBy) {
     auto rescale = makeTerm(Op::Rescale, {term});
     rescale->set<RescaleDivisorAttribute>(rescaleBy);
     return rescale;
   }
 
+  // Adds a copy of function to the functions of this program and returns its
+  // index, by which Call terms refer to it. The copy is taken now, so later
+  // changes to function are not seen by this program.
+  std::uint32_t addFunction(Program &function);
+
+  Program &getFunction(std::uint32_t index) const {
+    if (index >= functions.size()) {
+      throw std::out_of_range("No function with index " +
+                              std::to_string(index));
+    }
+    return *functions[index];
+  }
+
+  const auto &getFunctions() const { return functions; }
+
+  // Makes a Call term for each output of the function at index, with the
+  // inputs of the function bound to the terms in arguments by name. Returns
+  // the Call terms by output name. Calls are executed by reference only by
+  // the reference executor; the compiler expands each call into a copy of the
+  // function.
+  std::unordered_map<std::string, Term::Ptr>
+  makeCall(std::uint32_t index,
+           const std::unordered_map<std::string, Term::Ptr> &arguments);
+
   Term::Ptr getInput(std::string name) const {
     if (inputs.find(name) == inputs.end()) {
       std::stringstream s;
@@ -99,15 +146,47 @@ public:
     return inputs.at(name);
   }
 
+  // Removes an input from the program. Its term remains in the program for as
+  // long as it has uses.
+  void removeInput(const std::string &name) {
+    if (inputs.erase(name) == 0) {
+      throw std::out_of_range("No input named " + name);
+    }
+  }
+
+  // Removes an output from the program. Its term is destroyed once no longer
+  // referenced elsewhere.
+  void removeOutput(const std::string &name) {
+    if (outputs.erase(name) == 0) {
+      throw std::out_of_range("No output named " + name);
+    }
+  }
+
   const auto &getInputs() const { return inputs; }
 
   const auto &getOutputs() const { return outputs; }
 
+  // The names of the inputs and outputs in sorted order. This is the order of
+  // the operands of Call terms and of their ResultAttribute.
+  std::vector<std::string> getInputNames() const;
+  std::vector<std::string> getOutputNames() const;
+
   std::string getName() const { return name; }
   void setName(std::string newName) { name = newName; }
 
   std::uint32_t getVecSize() const { return vecSize; }
 
+  // Widens the vectors of this program. Existing constants are replicated to
+  // the new size, so this does not change the values computed in the first
+  // vecSize elements.
+  void widenVecSize(std::uint32_t newVecSize) {
+    if (newVecSize < vecSize || (newVecSize & (newVecSize - 1)) != 0) {
+      throw std::runtime_error(
+          "Vector size can only be widened to a larger power-of-two");
+    }
+    vecSize = newVecSize;
+  }
+
   std::vector<Term::Ptr> getSources() const;
 
   std::vector<Term::Ptr> getSinks() const;
@@ -136,6 +215,8 @@ private:
   std::uint64_t nextTermIndex;
   std::vector<TermMapBase *> termMaps;
 
+  std::vector<std::unique_ptr<Program>> functions;
+
   // These members must currently be last, because their destruction triggers
   // associated Terms to be destructed, which still use the sources and sinks
   // structures above.
@@ -148,9 +229,13 @@ private:
   friend class Term;
   friend class TermMapBase;
   friend std::unique_ptr<msg::Program> serialize(const Program &);
+  friend std::unique_ptr<msg::Program> serialize(const Program &,
+                                                 const ConstantEncoding &);
   friend std::unique_ptr<Program> deserialize(const msg::Program &);
 };
 
+std::unique_ptr<msg::Program> serialize(const Program &,
+                                        const ConstantEncoding &);
 std::unique_ptr<Program> deserialize(const msg::Program &);
 
 } // namespace eva
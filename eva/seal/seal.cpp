@@ -4,11 +4,18 @@
 #include "eva/seal/seal.h"
 #include "eva/common/program_traversal.h"
 #include "eva/common/valuation.h"
+#include "eva/ir/term_map.h"
 #include "eva/seal/seal_executor.h"
 #include "eva/util/logging.h"
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <set>
 #include <stdexcept>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -21,16 +28,73 @@ using namespace std;
 
 namespace eva {
 
-SEALValuation SEALPublic::encrypt(const Valuation &inputs,
+// Places the inputs that were packed by the compiler into the vectors of their
+// packed inputs. Other inputs are copied as is, or with each element repeated
+// over the slots between elements when the layout is interleaved.
+static Valuation packInputs(const Valuation &inputs,
+                            const CKKSSignature &signature) {
+  Valuation packed;
+  for (auto &[name, v] : inputs) {
+    if (v.size() != signature.vecSize) {
+      throw runtime_error("Input size does not match program vector size");
+    }
+    auto iter = signature.packedInputs.find(name);
+    if (iter == signature.packedInputs.end()) {
+      auto &value = packed[name];
+      for (auto element : v) {
+        value.insert(value.end(), signature.stride, element);
+      }
+      continue;
+    }
+    auto &info = iter->second;
+    auto &packedValue = packed[info.packedName];
+    packedValue.resize(info.packedSize);
+    for (size_t i = 0; i < v.size(); ++i) {
+      packedValue[info.offset + i * signature.stride] = v[i];
+    }
+  }
+  return packed;
+}
+
+// Splits the inputs into the tiles that the compiler split their vectors into
+static Valuation tileInputs(const Valuation &inputs,
+                            const CKKSSignature &signature) {
+  auto tileSize = signature.vecSize / signature.tiles;
+  Valuation tiled;
+  for (auto &[name, v] : inputs) {
+    if (v.size() != signature.vecSize) {
+      throw runtime_error("Input size does not match program vector size");
+    }
+    for (int t = 0; t < signature.tiles; ++t) {
+      auto first = v.begin() + t * tileSize;
+      tiled[getTileName(name, t)].assign(first, first + tileSize);
+    }
+  }
+  return tiled;
+}
+
+SEALValuation SEALPublic::encrypt(const Valuation &unpackedInputs,
                                   const CKKSSignature &signature) {
+  // Each tile of a vector is encrypted into a separate ciphertext
+  size_t vecSize = signature.vecSize / signature.tiles;
   size_t slotCount = encoder.slot_count();
-  if (slotCount < signature.vecSize) {
+  if (slotCount < vecSize) {
     throw runtime_error("Vector size cannot be larger than slot count");
   }
-  if (slotCount % signature.vecSize != 0) {
+  if (slotCount % vecSize != 0) {
     throw runtime_error("Vector size must exactly divide the slot count");
   }
 
+  Valuation packedInputs;
+  if (!signature.packedInputs.empty()) {
+    packedInputs = packInputs(unpackedInputs, signature);
+  } else if (signature.tiles > 1) {
+    packedInputs = tileInputs(unpackedInputs, signature);
+  }
+  auto &inputs = signature.packedInputs.empty() && signature.tiles == 1
+                     ? unpackedInputs
+                     : packedInputs;
+
   SEALValuation sealInputs(context);
   for (auto &in : inputs) {
 
@@ -50,11 +114,26 @@ SEALValuation SEALPublic::encrypt(const Valuation &inputs,
         auto name = in.first;
         auto &v = in.second;
         auto vSize = v.size();
-        // TODO remove this check
-        if (vSize != signature.vecSize) {
+        auto info = signature.inputs.at(name);
+        // With batched instances an input holds a vector for each instance,
+        // or a single vector that is shared by all of them
+        auto instances = vSize / vecSize;
+        bool batched = signature.lanes > 1 && instances > 1;
+        if (batched) {
+          if (vSize % vecSize != 0 || instances > signature.lanes) {
+            throw runtime_error("Input size must be a multiple of the program "
+                                "vector size for at most " +
+                                to_string(signature.lanes) + " instances");
+          }
+          if (info.inputType == Type::Raw) {
+            throw runtime_error(
+                "Unencrypted inputs must be shared by all instances");
+          }
+        } else if (vSize != vecSize && signature.packedInputs.empty()) {
+          // TODO remove this check
+          // (packed inputs have their sizes checked when packing)
           throw runtime_error("Input size does not match program vector size");
         }
-        auto info = signature.inputs.at(name);
 
         auto ctxData = context.first_context_data();
         for (size_t i = 0; i < info.level; ++i) {
@@ -64,7 +143,13 @@ SEALValuation SEALPublic::encrypt(const Valuation &inputs,
         if (info.inputType == Type::Cipher || info.inputType == Type::Plain) {
           seal::Plaintext plain;
 
-          if (vSize == 1) {
+          if (batched) {
+            // Instances go into consecutive lanes and unused lanes are zero
+            vector<double> vec(slotCount);
+            copy(v.begin(), v.end(), vec.begin());
+            encoder.encode(vec, ctxData->parms_id(), pow(2.0, info.scale),
+                           plain);
+          } else if (vSize == 1) {
             encoder.encode(v[0], ctxData->parms_id(), pow(2.0, info.scale),
                            plain);
           } else {
@@ -89,7 +174,7 @@ SEALValuation SEALPublic::encrypt(const Valuation &inputs,
           }
         } else {
           sealInputs[name] = std::shared_ptr<ConstantValue>(
-              new DenseConstantValue(signature.vecSize, v));
+              new DenseConstantValue(max(vecSize, vSize), v));
         }
       }
 #ifdef EVA_USE_GALOIS
@@ -101,8 +186,10 @@ SEALValuation SEALPublic::encrypt(const Valuation &inputs,
   return sealInputs;
 }
 
-SEALValuation SEALPublic::execute(Program &program,
-                                  const SEALValuation &inputs) {
+template <class TValuation>
+SEALValuation SEALPublic::executeProgram(Program &program,
+                                         TValuation &&inputs,
+                                         const SEALFixedValues *fixed) {
 #ifdef EVA_USE_GALOIS
   // Do multicore evaluation if multicore support is available
   GaloisGuard galois;
@@ -111,9 +198,9 @@ SEALValuation SEALPublic::execute(Program &program,
   // Otherwise fall back to singlecore evaluation
   ProgramTraversal programTraverse(program);
 #endif
-  auto sealExecutor = SEALExecutor(program, context, encoder, encryptor,
-                                   evaluator, galoisKeys, relinKeys);
-  sealExecutor.setInputs(inputs);
+  auto sealExecutor = SEALExecutor(program, context, encoder, evaluator,
+                                   galoisKeys, relinKeys, fixed);
+  sealExecutor.setInputs(std::forward<TValuation>(inputs));
   programTraverse.forwardPass(sealExecutor);
 
   SEALValuation encOutputs(context);
@@ -121,8 +208,162 @@ SEALValuation SEALPublic::execute(Program &program,
   return encOutputs;
 }
 
+SEALValuation SEALPublic::execute(Program &program,
+                                  const SEALValuation &inputs) {
+  return executeProgram(program, inputs, nullptr);
+}
+
+SEALValuation SEALPublic::execute(Program &program, SEALValuation &&inputs) {
+  return executeProgram(program, move(inputs), nullptr);
+}
+
+shared_ptr<const SEALFixedValues>
+SEALPublic::prepare(Program &program, const SEALValuation &bound) {
+  SEALExecutor sealExecutor(program, context, encoder, evaluator, galoisKeys,
+                            relinKeys);
+  return make_shared<SEALFixedValues>(sealExecutor.computeFixedValues(bound));
+}
+
+SEALValuation SEALPublic::execute(Program &program,
+                                  const SEALValuation &inputs,
+                                  const SEALFixedValues &fixed) {
+  return executeProgram(program, inputs, &fixed);
+}
+
+SEALValuation SEALPublic::execute(Program &program, SEALValuation &&inputs,
+                                  const SEALFixedValues &fixed) {
+  return executeProgram(program, move(inputs), &fixed);
+}
+
+template <class TValuation>
+SEALValuation SEALPublic::executeFlat(const FlatProgram &program,
+                                      TValuation &&inputs,
+                                      const SEALFixedValues *fixed) {
+  FlatSEALExecutor sealExecutor(program, context, encoder, evaluator,
+                                galoisKeys, relinKeys, fixed);
+  sealExecutor.setInputs(std::forward<TValuation>(inputs));
+  sealExecutor.run();
+  SEALValuation encOutputs(context);
+  sealExecutor.getOutputs(encOutputs);
+  return encOutputs;
+}
+
+SEALValuation SEALPublic::execute(const FlatProgram &program,
+                                  const SEALValuation &inputs) {
+  return executeFlat(program, inputs, nullptr);
+}
+
+SEALValuation SEALPublic::execute(const FlatProgram &program,
+                                  SEALValuation &&inputs) {
+  return executeFlat(program, move(inputs), nullptr);
+}
+
+shared_ptr<const SEALFixedValues>
+SEALPublic::prepare(const FlatProgram &program) {
+  FlatSEALExecutor sealExecutor(program, context, encoder, evaluator,
+                                galoisKeys, relinKeys);
+  return make_shared<SEALFixedValues>(sealExecutor.computeFixedValues());
+}
+
+shared_ptr<const SEALFixedValues>
+SEALPublic::prepare(const FlatProgram &program, const SEALValuation &bound) {
+  FlatSEALExecutor sealExecutor(program, context, encoder, evaluator,
+                                galoisKeys, relinKeys);
+  return make_shared<SEALFixedValues>(sealExecutor.computeFixedValues(&bound));
+}
+
+SEALValuation SEALPublic::execute(const FlatProgram &program,
+                                  const SEALValuation &inputs,
+                                  const SEALFixedValues &fixed) {
+  return executeFlat(program, inputs, &fixed);
+}
+
+SEALValuation SEALPublic::execute(const FlatProgram &program,
+                                  SEALValuation &&inputs,
+                                  const SEALFixedValues &fixed) {
+  return executeFlat(program, move(inputs), &fixed);
+}
+
+unique_ptr<SEALPublic> SEALPublic::restrictTo(Program &program) const {
+  // Only rotations and relinearizations of ciphertexts need keys
+  set<int> rotations;
+  bool relinearizes = false;
+  TermMap<bool> encrypted(program);
+  ProgramTraversal(program).forwardPass([&](Term::Ptr &term) {
+    if (term->op == Op::Input) {
+      encrypted[term] = term->get<TypeAttribute>() == Type::Cipher;
+    }
+    for (auto &operand : term->getOperands()) {
+      if (encrypted[operand]) encrypted[term] = true;
+    }
+    if (!encrypted[term]) return;
+    if (term->op == Op::RotateLeftConst) {
+      rotations.insert(term->get<RotationAttribute>());
+    } else if (term->op == Op::RotateRightConst) {
+      rotations.insert(-term->get<RotationAttribute>());
+    } else if (term->op == Op::Relinearize) {
+      relinearizes = true;
+    }
+  });
+
+  auto galoisTool = context.key_context_data()->galois_tool();
+  vector<bool> needed(galoisKeys.data().size(), false);
+  for (auto rotation : rotations) {
+    if (rotation == 0) continue;
+    auto element = galoisTool->get_elt_from_step(rotation);
+    if (!galoisKeys.has_key(element)) {
+      throw runtime_error("This context has no rotation key for " +
+                          to_string(rotation));
+    }
+    needed[seal::GaloisKeys::get_index(element)] = true;
+  }
+  auto restrictedGaloisKeys = galoisKeys;
+  for (size_t i = 0; i < needed.size(); ++i) {
+    if (!needed[i]) restrictedGaloisKeys.data()[i].clear();
+  }
+
+  seal::RelinKeys restrictedRelinKeys;
+  if (relinearizes) {
+    if (relinKeys.size() == 0) {
+      throw runtime_error("This context has no relinearization keys");
+    }
+    restrictedRelinKeys = relinKeys;
+  }
+
+  auto restricted = make_unique<SEALPublic>(
+      context, publicKey, restrictedGaloisKeys, restrictedRelinKeys);
+
+  // Keep the seeded forms of the remaining keys, if this context has them for
+  // every step, so that the restricted context is saved seeded too
+  bool seededSteps = seededPublicKey.has_value();
+  for (auto rotation : rotations) {
+    if (rotation != 0 && seededGaloisKeys.count(rotation) == 0) {
+      seededSteps = false;
+    }
+  }
+  if (seededSteps) {
+    restricted->seededPublicKey = seededPublicKey;
+    for (auto rotation : rotations) {
+      auto iter = seededGaloisKeys.find(rotation);
+      if (iter != seededGaloisKeys.end()) {
+        restricted->seededGaloisKeys.emplace(*iter);
+      }
+    }
+    if (relinearizes) restricted->seededRelinKeys = seededRelinKeys;
+  }
+  return restricted;
+}
+
 Valuation SEALSecret::decrypt(const SEALValuation &encOutputs,
                               const CKKSSignature &signature) {
+  unordered_set<string> packedNames;
+  for (auto &entry : signature.packedOutputs) {
+    packedNames.insert(entry.second.packedName);
+  }
+
+  // Each tile of a vector is decrypted from a separate ciphertext
+  size_t vecSize = signature.vecSize / signature.tiles;
+
   Valuation outputs;
   std::vector<double> tempVec;
   for (auto &out : encOutputs) {
@@ -136,43 +377,139 @@ Valuation SEALSecret::decrypt(const SEALValuation &encOutputs,
                        encoder.decode(plain, outputs[name]);
                      },
                      [&](const std::shared_ptr<ConstantValue> &raw) {
+                       // Expand to the slot count, as the compiled program
+                       // may have a wider vector size when inputs are packed
                        auto &scratch = tempVec;
-                       outputs[name] = raw->expand(scratch, signature.vecSize);
+                       outputs[name] =
+                           raw->expand(scratch, encoder.slot_count());
                      }},
           out.second);
-    outputs.at(name).resize(signature.vecSize);
+    if (packedNames.count(name) == 0) {
+      auto &output = outputs.at(name);
+      for (size_t i = 1; signature.stride > 1 && i < vecSize; ++i) {
+        output[i] = output[i * signature.stride];
+      }
+      output.resize(signature.lanes * vecSize);
+    }
+  }
+
+  // Join the tiles of outputs that the compiler split into tiles
+  if (signature.tiles > 1) {
+    Valuation joined;
+    for (auto &[name, tile] : outputs) {
+      // The index of the tile follows the last separator in its name
+      auto separator = name.rfind('#');
+      auto t = stoi(name.substr(separator + 1));
+      auto &output = joined[name.substr(0, separator)];
+      output.resize(signature.vecSize);
+      copy(tile.begin(), tile.end(), output.begin() + t * vecSize);
+    }
+    outputs = move(joined);
+  }
+
+  // Unpack outputs that the compiler packed together
+  for (auto &[name, info] : signature.packedOutputs) {
+    auto &packed = outputs.at(info.packedName);
+    auto first = packed.begin() + info.offset;
+    outputs[name].assign(first, first + signature.vecSize);
+  }
+  for (auto &packedName : packedNames) {
+    outputs.erase(packedName);
   }
   return outputs;
 }
 
-seal::SEALContext getSEALContext(const seal::EncryptionParameters &params) {
-  static unordered_map<seal::EncryptionParameters, seal::SEALContext> cache;
-
-  // clean cache except for the required entry
-  for (auto iter = cache.begin(); iter != cache.end();) {
-    // accessing the context data increases the reference count by one
-    // Another reference is incremented by cache entry
-    if (iter->second.key_context_data().use_count() == 2 &&
-        iter->first != params) {
-      iter = cache.erase(iter);
+seal::SEALContext
+SEALContextRegistry::get(const seal::EncryptionParameters &params) {
+  std::shared_future<seal::SEALContext> context;
+  std::promise<seal::SEALContext> creation;
+  bool create = false;
+  uint64_t creationId = 0;
+  {
+    lock_guard<std::mutex> lock(mutex);
+    auto iter = index.find(params);
+    if (iter != index.end()) {
+      entries.splice(entries.begin(), entries, iter->second);
+      context = iter->second->context;
     } else {
-      ++iter;
+      context = creation.get_future().share();
+      create = true;
+      creationId = ++creations;
+      entries.push_front({params, context, creationId});
+      index.emplace(params, entries.begin());
+      evict();
     }
   }
 
-  // find SEALContext
-  if (cache.count(params) != 0) {
-    seal::SEALContext result = cache.at(params);
-    return result;
-  } else {
-    auto result = cache.emplace(make_pair(
-        params, seal::SEALContext(params, true, seal::sec_level_type::none)));
-    return result.first->second;
+  // Create the context outside of the lock, so that other parameters can be
+  // looked up meanwhile. Threads asking for the same parameters wait for it.
+  if (create) {
+    try {
+      creation.set_value(
+          seal::SEALContext(params, true, seal::sec_level_type::none));
+    } catch (...) {
+      creation.set_exception(current_exception());
+      // The failed entry may have been evicted and the parameters created
+      // again by another thread meanwhile, in which case that entry stays
+      lock_guard<std::mutex> lock(mutex);
+      auto iter = index.find(params);
+      if (iter != index.end() && iter->second->creation == creationId) {
+        entries.erase(iter->second);
+        index.erase(iter);
+      }
+    }
   }
+  return context.get();
 }
 
-tuple<unique_ptr<SEALPublic>, unique_ptr<SEALSecret>>
-generateKeys(const CKKSParameters &abstractParams) {
+void SEALContextRegistry::prewarm(const seal::EncryptionParameters &params) {
+  get(params);
+}
+
+void SEALContextRegistry::prewarm(const CKKSParameters &params) {
+  get(getEncryptionParameters(params));
+}
+
+size_t SEALContextRegistry::getCapacity() const {
+  lock_guard<std::mutex> lock(mutex);
+  return capacity;
+}
+
+void SEALContextRegistry::setCapacity(size_t newCapacity) {
+  lock_guard<std::mutex> lock(mutex);
+  capacity = newCapacity;
+  evict();
+}
+
+size_t SEALContextRegistry::size() const {
+  lock_guard<std::mutex> lock(mutex);
+  return entries.size();
+}
+
+void SEALContextRegistry::clear() {
+  lock_guard<std::mutex> lock(mutex);
+  entries.clear();
+  index.clear();
+}
+
+void SEALContextRegistry::evict() {
+  while (entries.size() > capacity) {
+    index.erase(entries.back().params);
+    entries.pop_back();
+  }
+}
+
+SEALContextRegistry &SEALContextRegistry::global() {
+  static SEALContextRegistry registry;
+  return registry;
+}
+
+seal::SEALContext getSEALContext(const seal::EncryptionParameters &params) {
+  return SEALContextRegistry::global().get(params);
+}
+
+seal::EncryptionParameters
+getEncryptionParameters(const CKKSParameters &abstractParams) {
   vector<int> logQs(abstractParams.primeBits.begin(),
                     abstractParams.primeBits.end());
 
@@ -180,8 +517,37 @@ generateKeys(const CKKSParameters &abstractParams) {
   params.set_poly_modulus_degree(abstractParams.polyModulusDegree);
   params.set_coeff_modulus(
       seal::CoeffModulus::Create(abstractParams.polyModulusDegree, logQs));
+  return params;
+}
 
-  auto context = getSEALContext(params);
+void mergeGaloisKeys(seal::GaloisKeys &keys, seal::GaloisKeys &&part) {
+  auto &partData = part.data();
+  auto &data = keys.data();
+  if (data.size() < partData.size()) {
+    data.resize(partData.size());
+  }
+  for (size_t i = 0; i < partData.size(); ++i) {
+    if (!partData[i].empty()) data[i] = move(partData[i]);
+  }
+  keys.parms_id() = part.parms_id();
+}
+
+// Loads keys from their seeded form to get keys that can be computed with
+template <class T>
+static T loadSeeded(const seal::SEALContext &context,
+                    const seal::Serializable<T> &seeded) {
+  vector<seal::seal_byte> buffer(
+      seeded.save_size(seal::compr_mode_type::none));
+  auto size =
+      seeded.save(buffer.data(), buffer.size(), seal::compr_mode_type::none);
+  T keys;
+  keys.load(context, buffer.data(), size);
+  return keys;
+}
+
+tuple<unique_ptr<SEALPublic>, unique_ptr<SEALSecret>>
+generateKeys(const CKKSParameters &abstractParams, bool seeded) {
+  auto context = getSEALContext(getEncryptionParameters(abstractParams));
 
   seal::KeyGenerator keygen(context);
   vector<int> rotationsVec(abstractParams.rotations.begin(),
@@ -190,14 +556,66 @@ generateKeys(const CKKSParameters &abstractParams) {
   seal::PublicKey public_key;
   seal::GaloisKeys galois_keys;
   seal::RelinKeys relin_keys;
+  optional<seal::Serializable<seal::PublicKey>> seeded_public_key;
+  optional<seal::Serializable<seal::RelinKeys>> seeded_relin_keys;
 
-  keygen.create_public_key(public_key);
-  keygen.create_galois_keys(rotationsVec, galois_keys);
-  keygen.create_relin_keys(relin_keys);
+  if (seeded) {
+    seeded_public_key = keygen.create_public_key();
+    public_key = loadSeeded(context, *seeded_public_key);
+  } else {
+    keygen.create_public_key(public_key);
+  }
+
+  // Each rotation key is generated separately, which only reads the secret
+  // key, and the keys are merged afterwards
+  vector<seal::GaloisKeys> parts(rotationsVec.size());
+  vector<optional<seal::Serializable<seal::GaloisKeys>>> seededParts(
+      rotationsVec.size());
+  auto createRotationKey = [&](size_t i) {
+    vector<int> steps{rotationsVec[i]};
+    if (seeded) {
+      seededParts[i] = keygen.create_galois_keys(steps);
+      parts[i] = loadSeeded(context, *seededParts[i]);
+    } else {
+      keygen.create_galois_keys(steps, parts[i]);
+    }
+  };
+#ifdef EVA_USE_GALOIS
+  GaloisGuard galois;
+  galois::do_all(galois::iterate(size_t(0), rotationsVec.size()),
+                 createRotationKey, galois::no_stats(),
+                 galois::loopname("CreateRotationKeys"));
+#else
+  for (size_t i = 0; i < rotationsVec.size(); ++i) {
+    createRotationKey(i);
+  }
+#endif
+  keygen.create_galois_keys(vector<int>{}, galois_keys);
+  for (auto &part : parts) {
+    mergeGaloisKeys(galois_keys, move(part));
+  }
+
+  // Programs that do not multiply ciphertexts together never relinearize
+  if (abstractParams.needsRelinKeys) {
+    if (seeded) {
+      seeded_relin_keys = keygen.create_relin_keys();
+      relin_keys = loadSeeded(context, *seeded_relin_keys);
+    } else {
+      keygen.create_relin_keys(relin_keys);
+    }
+  }
 
   auto secretCtx = make_unique<SEALSecret>(context, keygen.secret_key());
   auto publicCtx =
       make_unique<SEALPublic>(context, public_key, galois_keys, relin_keys);
+  if (seeded) {
+    publicCtx->seededPublicKey = move(seeded_public_key);
+    for (size_t i = 0; i < rotationsVec.size(); ++i) {
+      publicCtx->seededGaloisKeys.emplace(rotationsVec[i],
+                                          move(*seededParts[i]));
+    }
+    publicCtx->seededRelinKeys = move(seeded_relin_keys);
+  }
 
   return make_tuple(move(publicCtx), move(secretCtx));
 }
@@ -7,13 +7,22 @@
 #include "eva/ckks/ckks_signature.h"
 #include "eva/common/valuation.h"
 #include "eva/ir/program.h"
+#include "eva/serialization/flat_program.h"
 #include "eva/serialization/seal.pb.h"
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <list>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <seal/seal.h>
 #include <string>
 #include <tuple>
 #include <unordered_map>
+#include <utility>
 #include <variant>
 
 namespace eva {
@@ -42,6 +51,9 @@ private:
 
 std::unique_ptr<SEALValuation> deserialize(const msg::SEALValuation &);
 
+class SEALSecret;
+struct SEALFixedValues;
+
 class SEALPublic {
 public:
   SEALPublic(seal::SEALContext ctx, seal::PublicKey pk, seal::GaloisKeys gk,
@@ -54,6 +66,50 @@ public:
 
   SEALValuation execute(Program &program, const SEALValuation &inputs);
 
+  // The overloads taking inputs by rvalue move the ciphertexts and plaintexts
+  // out of them instead of copying them
+  SEALValuation execute(Program &program, SEALValuation &&inputs);
+
+  // Computes the terms of program that do not depend on inputs other than the
+  // ones in bound, such as weights that stay the same across executions, once
+  // for executing it many times. Executing then takes only the other inputs.
+  // The program must not be changed afterwards.
+  std::shared_ptr<const SEALFixedValues> prepare(Program &program,
+                                                 const SEALValuation &bound);
+
+  // Executes program with the values prepare computed for it
+  SEALValuation execute(Program &program, const SEALValuation &inputs,
+                        const SEALFixedValues &fixed);
+  SEALValuation execute(Program &program, SEALValuation &&inputs,
+                        const SEALFixedValues &fixed);
+
+  // Executes a program in the flat format directly. Terms are computed one at
+  // a time, even with multicore support.
+  SEALValuation execute(const FlatProgram &program,
+                        const SEALValuation &inputs);
+  SEALValuation execute(const FlatProgram &program, SEALValuation &&inputs);
+
+  // Computes the terms of program that do not depend on its inputs, such as
+  // the plaintexts of constants, once for executing it many times
+  std::shared_ptr<const SEALFixedValues> prepare(const FlatProgram &program);
+
+  // As above, with inputs such as weights that stay the same across executions
+  // bound to values in bound. Executing then takes only the other inputs.
+  std::shared_ptr<const SEALFixedValues> prepare(const FlatProgram &program,
+                                                 const SEALValuation &bound);
+
+  // Executes program with the values prepare computed for it
+  SEALValuation execute(const FlatProgram &program,
+                        const SEALValuation &inputs,
+                        const SEALFixedValues &fixed);
+  SEALValuation execute(const FlatProgram &program, SEALValuation &&inputs,
+                        const SEALFixedValues &fixed);
+
+  // Makes a copy of this context with only the rotation keys, and the
+  // relinearization keys if any, that executing program needs. The program
+  // must have been compiled for the parameters of this context.
+  std::unique_ptr<SEALPublic> restrictTo(Program &program) const;
+
 private:
   seal::SEALContext context;
 
@@ -65,7 +121,22 @@ private:
   seal::Encryptor encryptor;
   seal::Evaluator evaluator;
 
+  // Keys generated with seeds are also kept in the seeded form, which is about
+  // half the size and is what gets saved. Rotation keys are kept by step.
+  std::optional<seal::Serializable<seal::PublicKey>> seededPublicKey;
+  std::map<int, seal::Serializable<seal::GaloisKeys>> seededGaloisKeys;
+  std::optional<seal::Serializable<seal::RelinKeys>> seededRelinKeys;
+
+  template <class TValuation>
+  SEALValuation executeProgram(Program &program, TValuation &&inputs,
+                               const SEALFixedValues *fixed);
+  template <class TValuation>
+  SEALValuation executeFlat(const FlatProgram &program, TValuation &&inputs,
+                            const SEALFixedValues *fixed);
+
   friend std::unique_ptr<msg::SEALPublic> serialize(const SEALPublic &);
+  friend std::tuple<std::unique_ptr<SEALPublic>, std::unique_ptr<SEALSecret>>
+  generateKeys(const CKKSParameters &abstractParams, bool seeded);
 };
 
 std::unique_ptr<SEALPublic> deserialize(const msg::SEALPublic &);
@@ -91,9 +162,60 @@ private:
 
 std::unique_ptr<SEALSecret> deserialize(const msg::SEALSecret &);
 
+// Holds SEALContexts by their encryption parameters, as creating one
+// precomputes tables for every prime and is expensive. It may be used from
+// multiple threads, and a context is created only once even when several
+// threads ask for it at the same time. At most capacity contexts are held, and
+// the least recently used one is dropped for a new one. Contexts stay valid
+// after being dropped for as long as they are used elsewhere.
+class SEALContextRegistry {
+public:
+  SEALContextRegistry(std::size_t capacity = 16) : capacity(capacity) {}
+
+  seal::SEALContext get(const seal::EncryptionParameters &params);
+
+  // Creates the contexts for params ahead of their use
+  void prewarm(const seal::EncryptionParameters &params);
+  void prewarm(const CKKSParameters &params);
+
+  std::size_t getCapacity() const;
+  void setCapacity(std::size_t newCapacity);
+  std::size_t size() const;
+  void clear();
+
+  // The registry getSEALContext uses
+  static SEALContextRegistry &global();
+
+private:
+  struct Entry {
+    seal::EncryptionParameters params;
+    std::shared_future<seal::SEALContext> context;
+    // Tells apart entries for the same parameters created at different times
+    std::uint64_t creation;
+  };
+
+  mutable std::mutex mutex;
+  std::size_t capacity;
+  std::uint64_t creations = 0;
+  std::list<Entry> entries; // most recently used first
+  std::unordered_map<seal::EncryptionParameters, std::list<Entry>::iterator>
+      index;
+
+  void evict(); // the caller holds the lock
+};
+
 seal::SEALContext getSEALContext(const seal::EncryptionParameters &params);
 
+seal::EncryptionParameters
+getEncryptionParameters(const CKKSParameters &abstractParams);
+
+// Moves the keys held by part into keys, which must be for the same context
+void mergeGaloisKeys(seal::GaloisKeys &keys, seal::GaloisKeys &&part);
+
+// Generates only the relinearization keys the parameters ask for. Rotation
+// keys are generated in parallel with multicore support. With seeded the
+// public context is saved with seeded keys, which halves its size.
 std::tuple<std::unique_ptr<SEALPublic>, std::unique_ptr<SEALSecret>>
-generateKeys(const CKKSParameters &abstractParams);
+generateKeys(const CKKSParameters &abstractParams, bool seeded = false);
 
 } // namespace eva
@@ -0,0 +1,146 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "eva/seal/seal_bundle.h"
+#include "eva/seal/seal_executor.h"
+#include "eva/serialization/eva_format_version.h"
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace eva {
+
+static const char BUNDLE_MAGIC[8] = {'E', 'V', 'A', 'B', 'N', 'D', 'L', 0};
+static const uint32_t BUNDLE_BYTE_ORDER = 0x01020304;
+
+static void alignTo(string &out, size_t alignment) {
+  out.resize((out.size() + alignment - 1) / alignment * alignment);
+}
+
+string bundle(Program &program, const CKKSParameters &params,
+              const CKKSSignature &signature, const SEALPublic &publicCtx,
+              const ConstantEncoding &encoding) {
+  vector<pair<BundleSection::Kind, string>> contents;
+  contents.emplace_back(BundleSection::Program, flatten(program, encoding));
+  contents.emplace_back(BundleSection::Parameters,
+                        serialize(params)->SerializeAsString());
+  contents.emplace_back(BundleSection::Signature,
+                        serialize(signature)->SerializeAsString());
+  contents.emplace_back(
+      BundleSection::Public,
+      serialize(*publicCtx.restrictTo(program))->SerializeAsString());
+
+  BundleHeader header = {};
+  memcpy(header.magic, BUNDLE_MAGIC, sizeof(header.magic));
+  header.byteOrder = BUNDLE_BYTE_ORDER;
+  header.version = EVA_FORMAT_VERSION;
+  header.sectionCount = static_cast<uint32_t>(contents.size());
+
+  vector<BundleSection> sections(contents.size());
+  string out(sizeof(BundleHeader) + sections.size() * sizeof(BundleSection),
+             '\0');
+  for (size_t i = 0; i < contents.size(); ++i) {
+    alignTo(out, FLAT_PROGRAM_ALIGNMENT);
+    sections[i].kind = contents[i].first;
+    sections[i].offset = out.size();
+    sections[i].size = contents[i].second.size();
+    out += contents[i].second;
+  }
+  alignTo(out, FLAT_PROGRAM_ALIGNMENT);
+  header.size = out.size();
+  memcpy(&out[0], &header, sizeof(BundleHeader));
+  memcpy(&out[sizeof(BundleHeader)], sections.data(),
+         sections.size() * sizeof(BundleSection));
+  return out;
+}
+
+template <class TMsg>
+static auto parseSection(const char *data, const BundleSection &section) {
+  TMsg msg;
+  if (section.size > static_cast<uint64_t>(numeric_limits<int>::max()) ||
+      !msg.ParseFromArray(data + section.offset,
+                          static_cast<int>(section.size))) {
+    throw runtime_error("Could not parse bundle section");
+  }
+  return deserialize(msg);
+}
+
+SEALBundle::SEALBundle(const string &bytes)
+    : SEALBundle(copyToAlignedMemory(bytes)) {}
+
+SEALBundle::SEALBundle(MappedFile memory) {
+  auto data = static_cast<const char *>(memory.data.get());
+  if (memory.size < sizeof(BundleHeader)) {
+    throw runtime_error("Not a bundle");
+  }
+  auto header = reinterpret_cast<const BundleHeader *>(data);
+  if (memcmp(header->magic, BUNDLE_MAGIC, sizeof(header->magic)) != 0) {
+    throw runtime_error("Not a bundle");
+  }
+  if (header->byteOrder != BUNDLE_BYTE_ORDER) {
+    throw runtime_error("Bundle was written with another byte order");
+  }
+  if (header->version != EVA_FORMAT_VERSION) {
+    throw runtime_error("Serialization format version mismatch");
+  }
+  if (header->sectionCount > (memory.size - sizeof(BundleHeader)) /
+                                 sizeof(BundleSection)) {
+    throw runtime_error("Bundle sections out of bounds");
+  }
+
+  auto sections =
+      reinterpret_cast<const BundleSection *>(data + sizeof(BundleHeader));
+  for (uint32_t i = 0; i < header->sectionCount; ++i) {
+    auto &section = sections[i];
+    if (section.offset % FLAT_PROGRAM_ALIGNMENT != 0 ||
+        section.offset > memory.size ||
+        section.size > memory.size - section.offset) {
+      throw runtime_error("Bundle sections out of bounds");
+    }
+    switch (section.kind) {
+    case BundleSection::Program:
+      program = make_unique<FlatProgram>(
+          shared_ptr<const void>(memory.data, data + section.offset),
+          section.size);
+      break;
+    case BundleSection::Parameters:
+      parameters = parseSection<msg::CKKSParameters>(data, section);
+      break;
+    case BundleSection::Signature:
+      signature = parseSection<msg::CKKSSignature>(data, section);
+      break;
+    case BundleSection::Public:
+      publicCtx = parseSection<msg::SEALPublic>(data, section);
+      break;
+    default:
+      break;
+    }
+  }
+  if (!program || !parameters || !signature || !publicCtx) {
+    throw runtime_error("Bundle is missing sections");
+  }
+
+  fixedValues = publicCtx->prepare(*program);
+}
+
+unique_ptr<SEALBundle> SEALBundle::map(const string &path) {
+  return make_unique<SEALBundle>(mapFile(path));
+}
+
+void SEALBundle::bind(const SEALValuation &bound) {
+  fixedValues = publicCtx->prepare(*program, bound);
+}
+
+SEALValuation SEALBundle::execute(const SEALValuation &inputs) const {
+  return publicCtx->execute(*program, inputs, *fixedValues);
+}
+
+SEALValuation SEALBundle::execute(SEALValuation &&inputs) const {
+  return publicCtx->execute(*program, move(inputs), *fixedValues);
+}
+
+} // namespace eva
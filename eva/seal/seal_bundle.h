@@ -0,0 +1,98 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include "eva/ckks/ckks_parameters.h"
+#include "eva/ckks/ckks_signature.h"
+#include "eva/ir/program.h"
+#include "eva/seal/seal.h"
+#include "eva/serialization/constant_encoding.h"
+#include "eva/serialization/flat_program.h"
+#include "eva/util/mapped_file.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace eva {
+
+/*
+A bundle holds everything a worker needs to execute a compiled program in one
+file: the program in the flat format, its parameters and signature, and the
+public context with only the keys the program needs. The file starts with a
+BundleHeader followed by a BundleSection for each section, which is a manifest
+of where the sections are. Sections start at multiples of
+FLAT_PROGRAM_ALIGNMENT bytes, so that the program is used in place, and the
+other sections are parsed from where they are. Readers skip sections of kinds
+they do not know.
+*/
+
+struct BundleHeader {
+  char magic[8];
+  std::uint32_t byteOrder;
+  std::uint32_t version;
+  std::uint32_t sectionCount;
+  std::uint32_t reserved;
+  std::uint64_t size;
+};
+
+struct BundleSection {
+  enum Kind : std::uint32_t {
+    // A FlatProgram
+    Program = 1,
+    // Protobuf messages of the parameters, signature and public context
+    Parameters,
+    Signature,
+    Public
+  };
+
+  std::uint32_t kind;
+  std::uint32_t reserved;
+  std::uint64_t offset;
+  std::uint64_t size;
+};
+
+// Writes a bundle for the compiled program. The public context is restricted
+// to the keys the program needs.
+std::string bundle(Program &program, const CKKSParameters &params,
+                   const CKKSSignature &signature, const SEALPublic &publicCtx,
+                   const ConstantEncoding &encoding = ConstantEncoding());
+
+// A bundle loaded for executing its program. Loading creates the SEALContext
+// and computes everything that does not depend on the inputs, such as the
+// plaintexts of constants, so executing computes only the rest.
+class SEALBundle {
+public:
+  // Loads a copy of bytes
+  SEALBundle(const std::string &bytes);
+
+  // Loads memory, which it keeps alive
+  SEALBundle(MappedFile memory);
+
+  // Maps the file at path into memory
+  static std::unique_ptr<SEALBundle> map(const std::string &path);
+
+  const FlatProgram &getProgram() const { return *program; }
+  const CKKSParameters &getParameters() const { return *parameters; }
+  const CKKSSignature &getSignature() const { return *signature; }
+  SEALPublic &getPublic() const { return *publicCtx; }
+
+  // Binds inputs that stay the same across executions, such as weights, to
+  // values, replacing any bound before. Everything computed from them and
+  // constants only is computed here, and executing takes only the other
+  // inputs. Must not be called while executing.
+  void bind(const SEALValuation &bound);
+
+  SEALValuation execute(const SEALValuation &inputs) const;
+  // As above, moving the ciphertexts and plaintexts out of inputs
+  SEALValuation execute(SEALValuation &&inputs) const;
+
+private:
+  std::unique_ptr<FlatProgram> program;
+  std::unique_ptr<CKKSParameters> parameters;
+  std::unique_ptr<CKKSSignature> signature;
+  std::unique_ptr<SEALPublic> publicCtx;
+  std::shared_ptr<const SEALFixedValues> fixedValues;
+};
+
+} // namespace eva
@@ -3,9 +3,12 @@
 
 #pragma once
 
+#include "eva/common/program_traversal.h"
 #include "eva/ir/constant_value.h"
 #include "eva/ir/program.h"
 #include "eva/ir/term_map.h"
+#include "eva/seal/seal.h"
+#include "eva/serialization/flat_program.h"
 #include "eva/util/logging.h"
 #include "eva/util/overloaded.h"
 #include <algorithm>
@@ -17,6 +20,9 @@
 #include <numeric>
 #include <seal/seal.h>
 #include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -27,19 +33,210 @@
 
 namespace eva {
 
-// executes unencrypted computation
-class SEALExecutor {
+// Computes single operations with SEAL on the values of their operands. The
+// attributes of an operation are read from the term computing it, which is
+// either a Term or a term of a FlatProgram.
+class SEALOperations {
+public:
   using RuntimeValue =
       std::variant<seal::Ciphertext, seal::Plaintext, std::vector<double>>;
 
-  Program &program;
+  SEALOperations(std::uint64_t vecSize, seal::SEALContext ctx,
+                 seal::CKKSEncoder &ce, seal::Evaluator &e,
+                 seal::GaloisKeys &gk, seal::RelinKeys &rk)
+      : vecSize(vecSize), context(ctx), encoder(ce), evaluator(e),
+        galoisKeys(gk), relinKeys(rk) {
+    assert(vecSize <= encoder.slot_count());
+    assert((encoder.slot_count() % vecSize) == 0);
+  }
+
+  static bool isCipher(const RuntimeValue &value) {
+    return std::holds_alternative<seal::Ciphertext>(value);
+  }
+  static bool isPlain(const RuntimeValue &value) {
+    return std::holds_alternative<seal::Plaintext>(value);
+  }
+  static bool isRaw(const RuntimeValue &value) {
+    return std::holds_alternative<std::vector<double>>(value);
+  }
+
+  // Stores the result of term, which has operand values args, in value
+  template <class TTerm>
+  void compute(Op op, const TTerm &term,
+               const std::vector<const RuntimeValue *> &args,
+               RuntimeValue &value) {
+    switch (op) {
+    case Op::Constant: {
+      auto &output = initValue<std::vector<double>>(value);
+      expandConstant(output, term);
+    } break;
+    case Op::Encode: {
+      assert(args.size() == 1);
+      assert(isRaw(*args[0]));
+      auto &output = initValue<seal::Plaintext>(value);
+      encodeRaw(output, *args[0],
+                term.template get<EncodeAtScaleAttribute>(),
+                term.template get<EncodeAtLevelAttribute>());
+    } break;
+    case Op::Add:
+      assert(args.size() == 2);
+      if (isRaw(*args[0]) && isRaw(*args[1])) {
+        auto &output = initValue<std::vector<double>>(value);
+        binOpRaw<std::plus<double>>(output, *args[0], *args[1]);
+      } else { // handles plain and cipher
+        assert(isCipher(*args[0]) || isPlain(*args[0]));
+        assert(isCipher(*args[1]) || isPlain(*args[1]));
+        auto &output = initValue<seal::Ciphertext>(value);
+        add(output, *args[0], *args[1]);
+      }
+      break;
+    case Op::Sub:
+      assert(args.size() == 2);
+      if (isRaw(*args[0]) && isRaw(*args[1])) {
+        auto &output = initValue<std::vector<double>>(value);
+        binOpRaw<std::minus<double>>(output, *args[0], *args[1]);
+      } else { // handles plain and cipher
+        assert(isCipher(*args[0]) || isPlain(*args[0]));
+        assert(isCipher(*args[1]) || isPlain(*args[1]));
+        auto &output = initValue<seal::Ciphertext>(value);
+        sub(output, *args[0], *args[1]);
+      }
+      break;
+    case Op::Mul:
+      assert(args.size() == 2);
+      if (isRaw(*args[0]) && isRaw(*args[1])) {
+        auto &output = initValue<std::vector<double>>(value);
+        binOpRaw<std::multiplies<double>>(output, *args[0], *args[1]);
+      } else { // works on cipher, no plaintext support
+        assert(isCipher(*args[0]) || isCipher(*args[1]));
+        assert(!isRaw(*args[0]) && !isRaw(*args[1]));
+        auto &output = initValue<seal::Ciphertext>(value);
+        mul(output, *args[0], *args[1]);
+      }
+      break;
+    case Op::RotateLeftConst:
+      assert(args.size() == 1);
+      if (isRaw(*args[0])) {
+        auto &output = initValue<std::vector<double>>(value);
+        leftRotateRaw(output, *args[0],
+                      term.template get<RotationAttribute>());
+      } else { // works on cipher, no plaintext support
+        assert(isCipher(*args[0]));
+        auto &output = initValue<seal::Ciphertext>(value);
+        leftRotate(output, *args[0], term.template get<RotationAttribute>());
+      }
+      break;
+    case Op::RotateRightConst:
+      assert(args.size() == 1);
+      if (isRaw(*args[0])) {
+        auto &output = initValue<std::vector<double>>(value);
+        rightRotateRaw(output, *args[0],
+                       term.template get<RotationAttribute>());
+      } else { // works on cipher, no plaintext support
+        assert(isCipher(*args[0]));
+        auto &output = initValue<seal::Ciphertext>(value);
+        rightRotate(output, *args[0], term.template get<RotationAttribute>());
+      }
+      break;
+    case Op::Negate:
+      assert(args.size() == 1);
+      if (isRaw(*args[0])) {
+        auto &output = initValue<std::vector<double>>(value);
+        negateRaw(output, *args[0]);
+      } else { // works on cipher, no plaintext support
+        assert(isCipher(*args[0]));
+        auto &output = initValue<seal::Ciphertext>(value);
+        negate(output, *args[0]);
+      }
+      break;
+    case Op::Relinearize: {
+      assert(args.size() == 1);
+      assert(isCipher(*args[0]));
+      auto &output = initValue<seal::Ciphertext>(value);
+      relinearize(output, *args[0]);
+    } break;
+    case Op::ModSwitch: {
+      assert(args.size() == 1);
+      assert(isCipher(*args[0]));
+      auto &output = initValue<seal::Ciphertext>(value);
+      modSwitch(output, *args[0]);
+    } break;
+    case Op::Rescale: {
+      assert(args.size() == 1);
+      assert(isCipher(*args[0]));
+      auto &output = initValue<seal::Ciphertext>(value);
+      rescale(output, *args[0], term.template get<RescaleDivisorAttribute>());
+    } break;
+    case Op::Output: {
+      // The executors alias outputs to their operands instead of computing
+      // them where they can, which saves copying the value
+      assert(args.size() == 1);
+      value = *args[0];
+    } break;
+    default:
+      throw std::runtime_error("Unhandled op " + getOpName(op));
+    }
+  }
+
+  // Sets value to an input given in a SEALValuation. Ciphertexts and
+  // plaintexts are moved from an rvalue input and copied otherwise.
+  template <class TSchemeValue>
+  void setInput(RuntimeValue &value, TSchemeValue &&input) {
+    std::visit(
+        [&](auto &&input) {
+          using T = std::decay_t<decltype(input)>;
+          if constexpr (std::is_same_v<T, std::shared_ptr<ConstantValue>>) {
+            auto &raw = initValue<std::vector<double>>(value);
+            input->expandTo(raw, vecSize);
+          } else {
+            value = std::forward<decltype(input)>(input);
+          }
+        },
+        std::forward<TSchemeValue>(input));
+  }
+
+  // Gets an output to place into a SEALValuation, moving it from an rvalue
+  template <class TRuntimeValue> SchemeValue getOutput(TRuntimeValue &&value) {
+    return std::visit(
+        [&](auto &&output) -> SchemeValue {
+          using T = std::decay_t<decltype(output)>;
+          if constexpr (std::is_same_v<T, std::vector<double>>) {
+            return std::make_shared<DenseConstantValue>(
+                vecSize, std::forward<decltype(output)>(output));
+          } else {
+            return std::forward<decltype(output)>(output);
+          }
+        },
+        std::forward<TRuntimeValue>(value));
+  }
+
+  // Forwards a value held by a valuation, as an rvalue if the valuation is one
+  template <class TValuation, class TValue>
+  static decltype(auto) forwardValue(TValue &value) {
+    if constexpr (std::is_lvalue_reference_v<TValuation>) {
+      return static_cast<const TValue &>(value);
+    } else {
+      return std::move(value);
+    }
+  }
+
+  static void release(RuntimeValue &value) {
+    std::visit(Overloaded{[](seal::Ciphertext &cipher) { cipher.release(); },
+                          [](seal::Plaintext &plain) { plain.release(); },
+                          [](std::vector<double> &raw) {
+                            raw.clear();
+                            raw.shrink_to_fit();
+                          }},
+               value);
+  }
+
+private:
+  std::uint64_t vecSize;
   seal::SEALContext context;
   seal::CKKSEncoder &encoder;
-  seal::Encryptor &encryptor;
   seal::Evaluator &evaluator;
   seal::GaloisKeys &galoisKeys;
   seal::RelinKeys &relinKeys;
-  TermMapOptional<RuntimeValue> Objects;
 
   // Each thread has a separate scratch space into which constants are expanded
   // for encoding.
@@ -50,19 +247,9 @@ class SEALExecutor {
   std::vector<double> tempVec;
 #endif
 
-  bool isCipher(const Term::Ptr &t) {
-    return std::holds_alternative<seal::Ciphertext>(Objects.at(t));
-  }
-  bool isPlain(const Term::Ptr &t) {
-    return std::holds_alternative<seal::Plaintext>(Objects.at(t));
-  }
-  bool isRaw(const Term::Ptr &t) {
-    return std::holds_alternative<std::vector<double>>(Objects.at(t));
-  }
-
-  void rightRotateRaw(std::vector<double> &out, const Term::Ptr &args1,
+  void rightRotateRaw(std::vector<double> &out, const RuntimeValue &args1,
                       std::int32_t shift) {
-    auto &in = std::get<std::vector<double>>(Objects.at(args1));
+    auto &in = std::get<std::vector<double>>(args1);
 
     while (shift > 0 && shift >= in.size())
       shift -= in.size();
@@ -75,9 +262,9 @@ class SEALExecutor {
     copy_n(in.cbegin(), in.size() - shift, back_inserter(out));
   }
 
-  void leftRotateRaw(std::vector<double> &out, const Term::Ptr &args1,
+  void leftRotateRaw(std::vector<double> &out, const RuntimeValue &args1,
                      std::int32_t shift) {
-    auto &in = std::get<std::vector<double>>(Objects.at(args1));
+    auto &in = std::get<std::vector<double>>(args1);
 
     while (shift > 0 && shift >= in.size())
       shift -= in.size();
@@ -91,10 +278,10 @@ class SEALExecutor {
   }
 
   template <class Op>
-  void binOpRaw(std::vector<double> &out, const Term::Ptr &args1,
-                const Term::Ptr &args2) {
-    auto &in1 = std::get<std::vector<double>>(Objects.at(args1));
-    auto &in2 = std::get<std::vector<double>>(Objects.at(args2));
+  void binOpRaw(std::vector<double> &out, const RuntimeValue &args1,
+                const RuntimeValue &args2) {
+    auto &in1 = std::get<std::vector<double>>(args1);
+    auto &in2 = std::get<std::vector<double>>(args2);
     assert(in1.size() == in2.size());
 
     out.clear();
@@ -102,8 +289,8 @@ class SEALExecutor {
     transform(in1.cbegin(), in1.cend(), in2.cbegin(), back_inserter(out), Op());
   }
 
-  void negateRaw(std::vector<double> &out, const Term::Ptr &args1) {
-    auto &in = std::get<std::vector<double>>(Objects.at(args1));
+  void negateRaw(std::vector<double> &out, const RuntimeValue &args1) {
+    auto &in = std::get<std::vector<double>>(args1);
 
     out.clear();
     out.reserve(in.size());
@@ -111,14 +298,14 @@ class SEALExecutor {
               std::negate<double>());
   }
 
-  void add(seal::Ciphertext &output, const Term::Ptr &args1,
-           const Term::Ptr &args2) {
+  void add(seal::Ciphertext &output, const RuntimeValue &args1,
+           const RuntimeValue &args2) {
     if (!isCipher(args1)) {
       assert(isCipher(args2));
       add(output, args2, args1);
       return;
     }
-    seal::Ciphertext &input1 = std::get<seal::Ciphertext>(Objects.at(args1));
+    auto &input1 = std::get<seal::Ciphertext>(args1);
     // TODO: should a previous lowering get rid of this dispatch?
     std::visit(Overloaded{[&](const seal::Ciphertext &input2) {
                             evaluator.add(input1, input2, output);
@@ -130,12 +317,12 @@ class SEALExecutor {
                             throw std::runtime_error(
                                 "Unsupported operation encountered");
                           }},
-               Objects.at(args2));
+               args2);
   }
 
-  void sub(seal::Ciphertext &output, const Term::Ptr &args1,
-           const Term::Ptr &args2) {
-    seal::Ciphertext &input1 = std::get<seal::Ciphertext>(Objects.at(args1));
+  void sub(seal::Ciphertext &output, const RuntimeValue &args1,
+           const RuntimeValue &args2) {
+    auto &input1 = std::get<seal::Ciphertext>(args1);
     std::visit(Overloaded{[&](const seal::Ciphertext &input2) {
                             evaluator.sub(input1, input2, output);
                           },
@@ -146,19 +333,20 @@ class SEALExecutor {
                             throw std::runtime_error(
                                 "Unsupported operation encountered");
                           }},
-               Objects.at(args2));
+               args2);
   }
 
-  void mul(seal::Ciphertext &output, const Term::Ptr &args1,
-           const Term::Ptr &args2) {
+  void mul(seal::Ciphertext &output, const RuntimeValue &args1,
+           const RuntimeValue &args2) {
     // swap args if arg1 is plain type and arg2 is of cipher type
     if (!isCipher(args1) && isCipher(args2)) {
       mul(output, args2, args1);
       return;
     }
-    seal::Ciphertext &input1 = std::get<seal::Ciphertext>(Objects.at(args1));
+    auto &input1 = std::get<seal::Ciphertext>(args1);
     std::visit(Overloaded{[&](const seal::Ciphertext &input2) {
-                            if (args1 == args2) {
+                            // The same operand twice is the same value
+                            if (&input1 == &input2) {
                               evaluator.square(input1, output);
                             } else {
                               evaluator.multiply(input1, input2, output);
@@ -171,52 +359,46 @@ class SEALExecutor {
                             throw std::runtime_error(
                                 "Unsupported operation encountered");
                           }},
-               Objects.at(args2));
+               args2);
   }
 
-  void leftRotate(seal::Ciphertext &output, const Term::Ptr &args1,
+  void leftRotate(seal::Ciphertext &output, const RuntimeValue &args1,
                   std::int32_t rotation) {
-    assert(isCipher(args1));
-    seal::Ciphertext &input1 = std::get<seal::Ciphertext>(Objects.at(args1));
+    auto &input1 = std::get<seal::Ciphertext>(args1);
     evaluator.rotate_vector(input1, rotation, galoisKeys, output);
   }
 
-  void rightRotate(seal::Ciphertext &output, const Term::Ptr &args1,
+  void rightRotate(seal::Ciphertext &output, const RuntimeValue &args1,
                    std::int32_t rotation) {
-    assert(isCipher(args1));
-    seal::Ciphertext &input1 = std::get<seal::Ciphertext>(Objects.at(args1));
+    auto &input1 = std::get<seal::Ciphertext>(args1);
     evaluator.rotate_vector(input1, -rotation, galoisKeys, output);
   }
 
-  void negate(seal::Ciphertext &output, const Term::Ptr &args1) {
-    assert(isCipher(args1));
-    seal::Ciphertext &input1 = std::get<seal::Ciphertext>(Objects.at(args1));
+  void negate(seal::Ciphertext &output, const RuntimeValue &args1) {
+    auto &input1 = std::get<seal::Ciphertext>(args1);
     evaluator.negate(input1, output);
   }
 
-  void relinearize(seal::Ciphertext &output, const Term::Ptr &args1) {
-    assert(isCipher(args1));
-    seal::Ciphertext &input1 = std::get<seal::Ciphertext>(Objects.at(args1));
+  void relinearize(seal::Ciphertext &output, const RuntimeValue &args1) {
+    auto &input1 = std::get<seal::Ciphertext>(args1);
     evaluator.relinearize(input1, relinKeys, output);
   }
 
-  void modSwitch(seal::Ciphertext &output, const Term::Ptr &args1) {
-    assert(isCipher(args1));
-    seal::Ciphertext &input1 = std::get<seal::Ciphertext>(Objects.at(args1));
+  void modSwitch(seal::Ciphertext &output, const RuntimeValue &args1) {
+    auto &input1 = std::get<seal::Ciphertext>(args1);
     evaluator.mod_switch_to_next(input1, output);
   }
 
-  void rescale(seal::Ciphertext &output, const Term::Ptr &args1,
+  void rescale(seal::Ciphertext &output, const RuntimeValue &args1,
                std::uint32_t divisor) {
-    assert(isCipher(args1));
-    seal::Ciphertext &input1 = std::get<seal::Ciphertext>(Objects.at(args1));
+    auto &input1 = std::get<seal::Ciphertext>(args1);
     evaluator.rescale_to_next(input1, output);
     output.scale() = input1.scale() / pow(2.0, divisor);
   }
 
-  void encodeRaw(seal::Plaintext &output, const Term::Ptr &args1,
+  void encodeRaw(seal::Plaintext &output, const RuntimeValue &args1,
                  uint32_t scale, uint32_t level) {
-    auto &in = std::get<std::vector<double>>(Objects.at(args1));
+    auto &in = std::get<std::vector<double>>(args1);
 
     auto ctxData = context.first_context_data();
     for (std::size_t i = 0; i < level; ++i) {
@@ -226,8 +408,7 @@ class SEALExecutor {
     // If the slot count is larger than the vector size, then encode repetitions
     // of the vector to fill the slot count. This will provide the correct
     // semantics for rotations.
-    assert(encoder.slot_count() % program.getVecSize() == 0);
-    auto copies = encoder.slot_count() / program.getVecSize();
+    auto copies = encoder.slot_count() / vecSize;
 #ifdef EVA_USE_GALOIS
     auto &scratch = *tempVec.getLocal();
 #else
@@ -242,40 +423,65 @@ class SEALExecutor {
     encoder.encode(scratch, ctxData->parms_id(), pow(2.0, scale), output);
   }
 
+  void expandConstant(std::vector<double> &output, const Term &term) {
+    term.get<ConstantValueAttribute>()->expandTo(output, vecSize);
+  }
+
   void expandConstant(std::vector<double> &output,
-                      const std::shared_ptr<ConstantValue> constant) {
-    constant->expandTo(output, program.getVecSize());
+                      const FlatProgram::TermView &term) {
+    term.expandConstant(output, vecSize);
   }
 
-  template <typename T> T &initValue(const Term::Ptr &term) {
-    return std::get<T>(Objects[term] = T{});
+  template <typename T> static T &initValue(RuntimeValue &value) {
+    return std::get<T>(value = T{});
   }
+};
 
-public:
-  SEALExecutor(Program &g, seal::SEALContext ctx, seal::CKKSEncoder &ce,
-               seal::Encryptor &enc, seal::Evaluator &e, seal::GaloisKeys &gk,
-               seal::RelinKeys &rk)
-      : program(g), context(ctx), encoder(ce), encryptor(enc), evaluator(e),
-        galoisKeys(gk), relinKeys(rk), Objects(g) {
-    assert(program.getVecSize() <= encoder.slot_count());
-    assert((encoder.slot_count() % program.getVecSize()) == 0);
+// The values of the terms of a program that do not depend on its inputs, such
+// as encoded constants, for the terms that do and for outputs, by term index.
+// These are computed once for executing the program many times. Inputs bound
+// to values are fixed too, along with the terms computed from them and
+// constants only.
+struct SEALFixedValues {
+  std::vector<bool> fixed;
+  std::unordered_map<std::uint64_t, SEALOperations::RuntimeValue> values;
+
+  bool isFixed(std::uint64_t index) const {
+    return index < fixed.size() && fixed[index];
   }
+};
 
-  void setInputs(const SEALValuation &inputs) {
-    for (auto &in : inputs) {
-      auto term = program.getInput(in.first);
-      std::visit(
-          Overloaded{
-              [&](const seal::Ciphertext &input) { Objects[term] = input; },
-              [&](const seal::Plaintext &input) { Objects[term] = input; },
-              [&](const std::shared_ptr<ConstantValue> &input) {
-                auto &value = initValue<std::vector<double>>(term);
-                expandConstant(value, input);
-              }},
-          in.second);
-    }
+// executes unencrypted computation
+class SEALExecutor {
+  using RuntimeValue = SEALOperations::RuntimeValue;
+
+  Program &program;
+  SEALOperations operations;
+  const SEALFixedValues *fixedValues;
+  TermMapOptional<RuntimeValue> Objects;
+
+  bool isFixed(const Term::Ptr &term) const {
+    return fixedValues && fixedValues->isFixed(term->index);
+  }
+
+  const RuntimeValue &valueOf(const Term::Ptr &term) {
+    return isFixed(term) ? fixedValues->values.at(term->index)
+                         : Objects.at(term);
   }
 
+public:
+  // The program must not have changed since fixed was computed for it
+  SEALExecutor(Program &g, seal::SEALContext ctx, seal::CKKSEncoder &ce,
+               seal::Evaluator &e, seal::GaloisKeys &gk, seal::RelinKeys &rk,
+               const SEALFixedValues *fixed = nullptr)
+      : program(g), operations(g.getVecSize(), ctx, ce, e, gk, rk),
+        fixedValues(fixed), Objects(g) {}
+
+  void setInputs(const SEALValuation &inputs) { setInputsFrom(inputs); }
+
+  // As above, moving the ciphertexts and plaintexts out of inputs
+  void setInputs(SEALValuation &&inputs) { setInputsFrom(std::move(inputs)); }
+
   void operator()(const Term::Ptr &term) {
     if (verbosityAtLeast(Verbosity::Debug)) {
       printf("EVA: Execute t%lu = %s(", term->index,
@@ -293,144 +499,299 @@ public:
       fflush(stdout);
     }
 
-    if (term->op == Op::Input) return;
-    auto args = term->getOperands();
-    switch (term->op) {
-    case Op::Constant: {
-      auto &output = initValue<std::vector<double>>(term);
-      expandConstant(output, term->get<ConstantValueAttribute>());
-    } break;
-    case Op::Encode: {
-      assert(args.size() == 1);
-      assert(isRaw(args[0]));
-      auto &output = initValue<seal::Plaintext>(term);
-      encodeRaw(output, args[0], term->get<EncodeAtScaleAttribute>(),
-                term->get<EncodeAtLevelAttribute>());
-    } break;
-    case Op::Add:
-      assert(args.size() == 2);
-      if (isRaw(args[0]) && isRaw(args[1])) {
-        auto &output = initValue<std::vector<double>>(term);
-        binOpRaw<std::plus<double>>(output, args[0], args[1]);
-      } else { // handles plain and cipher
-        assert(isCipher(args[0]) || isPlain(args[0]));
-        assert(isCipher(args[1]) || isPlain(args[1]));
-        auto &output = initValue<seal::Ciphertext>(term);
-        add(output, args[0], args[1]);
+    // Outputs alias their operands, which are not freed
+    if (term->op == Op::Input || term->op == Op::Output || isFixed(term)) {
+      return;
+    }
+    std::vector<const RuntimeValue *> args;
+    for (auto &operand : term->getOperands()) {
+      args.push_back(&valueOf(operand));
+    }
+    operations.compute(term->op, *term, args, Objects[term]);
+  }
+
+  void free(const Term::Ptr &term) {
+    if (term->op == Op::Output || isFixed(term)) {
+      return;
+    }
+    for (auto &use : term->getUses()) {
+      if (use->op == Op::Output) return;
+    }
+    SEALOperations::release(Objects.at(term));
+  }
+
+  // Moves the outputs into encOutputs. Only values that several outputs alias
+  // are copied, so this may be called only once.
+  void getOutputs(SEALValuation &encOutputs) {
+    std::unordered_map<Term *, std::size_t> aliases;
+    for (auto &out : program.getOutputs()) {
+      ++aliases[out.second->operandAt(0).get()];
+    }
+    for (auto &out : program.getOutputs()) {
+      auto operand = out.second->operandAt(0);
+      if (isFixed(operand)) {
+        encOutputs[out.first] = operations.getOutput(valueOf(operand));
+        continue;
       }
-      break;
-    case Op::Sub:
-      assert(args.size() == 2);
-      if (isRaw(args[0]) && isRaw(args[1])) {
-        auto &output = initValue<std::vector<double>>(term);
-        binOpRaw<std::minus<double>>(output, args[0], args[1]);
-      } else { // handles plain and cipher
-        assert(isCipher(args[0]) || isPlain(args[0]));
-        assert(isCipher(args[1]) || isPlain(args[1]));
-        auto &output = initValue<seal::Ciphertext>(term);
-        sub(output, args[0], args[1]);
+      auto &value = Objects.at(operand);
+      if (--aliases[operand.get()] == 0) {
+        encOutputs[out.first] = operations.getOutput(std::move(value));
+      } else {
+        encOutputs[out.first] = operations.getOutput(value);
       }
-      break;
-    case Op::Mul:
-      assert(args.size() == 2);
-      if (isRaw(args[0]) && isRaw(args[1])) {
-        auto &output = initValue<std::vector<double>>(term);
-        binOpRaw<std::multiplies<double>>(output, args[0], args[1]);
-      } else { // works on cipher, no plaintext support
-        assert(isCipher(args[0]) || isCipher(args[1]));
-        assert(!isRaw(args[0]) && !isRaw(args[1]));
-        auto &output = initValue<seal::Ciphertext>(term);
-        mul(output, args[0], args[1]);
+    }
+  }
+
+  // Computes the terms that do not depend on inputs other than those in bound,
+  // keeping the values that the other terms and outputs use
+  SEALFixedValues computeFixedValues(const SEALValuation &bound) {
+    SEALFixedValues result;
+    for (auto &[name, value] : bound) {
+      if (program.getInputs().count(name) == 0) {
+        throw std::runtime_error("Program has no input " + name);
       }
-      break;
-    case Op::RotateLeftConst:
-      assert(args.size() == 1);
-      if (isRaw(args[0])) {
-        auto &output = initValue<std::vector<double>>(term);
-        leftRotateRaw(output, args[0], term->get<RotationAttribute>());
-      } else { // works on cipher, no plaintext support
-        assert(isCipher(args[0]));
-        auto &output = initValue<seal::Ciphertext>(term);
-        leftRotate(output, args[0], term->get<RotationAttribute>());
+    }
+
+    TermMap<bool> fixed(program);
+    TermMap<bool> kept(program);
+    TermMap<std::uint32_t> fixedUses(program);
+    std::uint64_t termCount = 0;
+    ProgramTraversal(program).forwardPass([&](Term::Ptr &term) {
+      termCount = std::max(termCount, term->index + 1);
+      if (term->op == Op::Input) {
+        fixed[term] = false;
+        for (auto &[name, value] : bound) {
+          if (program.getInput(name) == term) fixed[term] = true;
+        }
+      } else if (term->op != Op::Output) {
+        fixed[term] = true;
+        for (auto &operand : term->getOperands()) {
+          fixed[term] = fixed[term] && fixed[operand];
+        }
       }
-      break;
-    case Op::RotateRightConst:
-      assert(args.size() == 1);
-      if (isRaw(args[0])) {
-        auto &output = initValue<std::vector<double>>(term);
-        rightRotateRaw(output, args[0], term->get<RotationAttribute>());
-      } else { // works on cipher, no plaintext support
-        assert(isCipher(args[0]));
-        auto &output = initValue<seal::Ciphertext>(term);
-        rightRotate(output, args[0], term->get<RotationAttribute>());
+      for (auto &operand : term->getOperands()) {
+        if (fixed[term]) {
+          ++fixedUses[operand];
+        } else if (fixed[operand]) {
+          // Outputs are never fixed, so this keeps the values they alias too
+          kept[operand] = true;
+        }
       }
-      break;
-    case Op::Negate:
-      assert(args.size() == 1);
-      if (isRaw(args[0])) {
-        auto &output = initValue<std::vector<double>>(term);
-        negateRaw(output, args[0]);
-      } else { // works on cipher, no plaintext support
-        assert(isCipher(args[0]));
-        auto &output = initValue<seal::Ciphertext>(term);
-        negate(output, args[0]);
+    });
+
+    for (auto &[name, value] : bound) {
+      operations.setInput(Objects[program.getInput(name)], value);
+    }
+    std::vector<Term::Ptr> keptTerms;
+    ProgramTraversal(program).forwardPass([&](Term::Ptr &term) {
+      if (!fixed[term]) return;
+      if (kept[term]) keptTerms.push_back(term);
+      if (term->op == Op::Input) return;
+      std::vector<const RuntimeValue *> args;
+      for (auto &operand : term->getOperands()) {
+        args.push_back(&Objects.at(operand));
       }
-      break;
-    case Op::Relinearize: {
-      assert(args.size() == 1);
-      assert(isCipher(args[0]));
-      auto &output = initValue<seal::Ciphertext>(term);
-      relinearize(output, args[0]);
-    } break;
-    case Op::ModSwitch: {
-      assert(args.size() == 1);
-      assert(isCipher(args[0]));
-      auto &output = initValue<seal::Ciphertext>(term);
-      modSwitch(output, args[0]);
-    } break;
-    case Op::Rescale: {
-      assert(args.size() == 1);
-      assert(isCipher(args[0]));
-      auto &output = initValue<seal::Ciphertext>(term);
-      rescale(output, args[0], term->get<RescaleDivisorAttribute>());
-    } break;
-    case Op::Output: {
-      assert(args.size() == 1);
-      Objects[term] = Objects.at(args[0]);
-    } break;
-    default:
-      throw std::runtime_error("Unhandled op " + getOpName(term->op));
+      operations.compute(term->op, *term, args, Objects[term]);
+      for (auto &operand : term->getOperands()) {
+        if (--fixedUses[operand] == 0 && !kept[operand]) {
+          SEALOperations::release(Objects.at(operand));
+        }
+      }
+    });
+
+    result.fixed.assign(termCount, false);
+    ProgramTraversal(program).forwardPass([&](Term::Ptr &term) {
+      result.fixed[term->index] = fixed[term];
+    });
+    for (auto &term : keptTerms) {
+      result.values.emplace(term->index, std::move(Objects.at(term)));
     }
+    return result;
   }
 
-  void free(const Term::Ptr &term) {
-    if (term->op == Op::Output) {
-      return;
+private:
+  template <class TValuation> void setInputsFrom(TValuation &&inputs) {
+    for (auto &in : inputs) {
+      auto input = program.getInput(in.first);
+      if (isFixed(input)) {
+        throw std::runtime_error("Input " + in.first + " is bound");
+      }
+      operations.setInput(
+          Objects[input], SEALOperations::forwardValue<TValuation>(in.second));
+    }
+  }
+};
+
+// Executes a flat program in the order of its terms. Values are released once
+// all terms using them have been computed.
+class FlatSEALExecutor {
+  using RuntimeValue = SEALOperations::RuntimeValue;
+
+  const FlatProgram &program;
+  SEALOperations operations;
+  const SEALFixedValues *fixedValues;
+  std::vector<RuntimeValue> values;
+  std::vector<std::uint32_t> remainingUses;
+
+  bool isFixed(std::uint32_t index) const {
+    return fixedValues && fixedValues->fixed[index];
+  }
+
+  const RuntimeValue &valueOf(std::uint32_t index) const {
+    return isFixed(index) ? fixedValues->values.at(index) : values[index];
+  }
+
+public:
+  FlatSEALExecutor(const FlatProgram &p, seal::SEALContext ctx,
+                   seal::CKKSEncoder &ce, seal::Evaluator &e,
+                   seal::GaloisKeys &gk, seal::RelinKeys &rk,
+                   const SEALFixedValues *fixed = nullptr)
+      : program(p), operations(p.getVecSize(), ctx, ce, e, gk, rk),
+        fixedValues(fixed), values(p.numTerms()),
+        remainingUses(p.numTerms(), 0) {
+    if (fixed && fixed->fixed.size() != p.numTerms()) {
+      throw std::runtime_error("Prepared values are for another program");
+    }
+    for (std::uint32_t i = 0; i < program.numTerms(); ++i) {
+      if (isFixed(i)) continue;
+      auto term = program.getTerm(i);
+      for (std::size_t j = 0; j < term.numOperands(); ++j) {
+        ++remainingUses[term.operandAt(j)];
+      }
     }
-    auto &obj = Objects.at(term);
-    std::visit(Overloaded{[](seal::Ciphertext &cipher) { cipher.release(); },
-                          [](seal::Plaintext &plain) { plain.release(); },
-                          [](std::vector<double> &raw) {
-                            raw.clear();
-                            raw.shrink_to_fit();
-                          }},
-               obj);
   }
 
+  // Sets the inputs that are not bound
+  void setInputs(const SEALValuation &inputs) { setInputsFrom(inputs); }
+
+  // As above, moving the ciphertexts and plaintexts out of inputs
+  void setInputs(SEALValuation &&inputs) { setInputsFrom(std::move(inputs)); }
+
+private:
+  template <class TValuation> void setInputsFrom(TValuation &&inputs) {
+    std::size_t count = 0;
+    for (auto &in : inputs) {
+      auto index = program.getInputs().at(in.first);
+      if (isFixed(index)) {
+        throw std::runtime_error("Input " + in.first + " is bound");
+      }
+      operations.setInput(values.at(index),
+                          SEALOperations::forwardValue<TValuation>(in.second));
+      ++count;
+    }
+    std::size_t unbound = 0;
+    for (auto &[name, index] : program.getInputs()) {
+      if (!isFixed(index)) ++unbound;
+    }
+    if (count != unbound) {
+      throw std::runtime_error("Inputs do not match the program inputs");
+    }
+  }
+
+public:
+
+  // Computes the terms that do not depend on inputs other than those in bound,
+  // keeping the values that the other terms and outputs use
+  SEALFixedValues computeFixedValues(const SEALValuation *bound = nullptr) {
+    SEALFixedValues result;
+    result.fixed.assign(program.numTerms(), false);
+    if (bound) {
+      for (auto &[name, value] : *bound) {
+        auto input = program.getInputs().find(name);
+        if (input == program.getInputs().end()) {
+          throw std::runtime_error("Program has no input " + name);
+        }
+        operations.setInput(values[input->second], value);
+        result.fixed[input->second] = true;
+      }
+    }
+
+    std::vector<bool> kept(program.numTerms(), false);
+    std::vector<std::uint32_t> fixedUses(program.numTerms(), 0);
+    for (std::uint32_t i = 0; i < program.numTerms(); ++i) {
+      auto term = program.getTerm(i);
+      if (term.getOp() == Op::Input) continue;
+      bool fixed = true;
+      for (std::size_t j = 0; j < term.numOperands(); ++j) {
+        fixed = fixed && result.fixed[term.operandAt(j)];
+      }
+      result.fixed[i] = fixed;
+      for (std::size_t j = 0; j < term.numOperands(); ++j) {
+        auto operand = term.operandAt(j);
+        if (fixed) {
+          ++fixedUses[operand];
+        } else if (result.fixed[operand]) {
+          kept[operand] = true;
+        }
+      }
+      if (fixed && term.getOp() == Op::Output) {
+        kept[i] = true;
+      }
+    }
+
+    std::vector<const RuntimeValue *> args;
+    for (std::uint32_t i = 0; i < program.numTerms(); ++i) {
+      auto term = program.getTerm(i);
+      if (!result.fixed[i] || term.getOp() == Op::Input) continue;
+      args.clear();
+      for (std::size_t j = 0; j < term.numOperands(); ++j) {
+        args.push_back(&values[term.operandAt(j)]);
+      }
+      operations.compute(term.getOp(), term, args, values[i]);
+      for (std::size_t j = 0; j < term.numOperands(); ++j) {
+        auto operand = term.operandAt(j);
+        if (--fixedUses[operand] == 0 && !kept[operand]) {
+          SEALOperations::release(values[operand]);
+        }
+      }
+    }
+    for (std::uint32_t i = 0; i < program.numTerms(); ++i) {
+      if (kept[i]) {
+        result.values.emplace(i, std::move(values[i]));
+      }
+    }
+    return result;
+  }
+
+  // Computes the terms that are not fixed. Outputs alias their operands, which
+  // are thus never released.
+  void run() {
+    std::vector<const RuntimeValue *> args;
+    for (std::uint32_t i = 0; i < program.numTerms(); ++i) {
+      auto term = program.getTerm(i);
+      if (term.getOp() == Op::Input || term.getOp() == Op::Output ||
+          isFixed(i)) {
+        continue;
+      }
+      args.clear();
+      for (std::size_t j = 0; j < term.numOperands(); ++j) {
+        args.push_back(&valueOf(term.operandAt(j)));
+      }
+      operations.compute(term.getOp(), term, args, values[i]);
+      for (std::size_t j = 0; j < term.numOperands(); ++j) {
+        auto operand = term.operandAt(j);
+        if (--remainingUses[operand] == 0 && !isFixed(operand)) {
+          SEALOperations::release(values[operand]);
+        }
+      }
+    }
+  }
+
+  // Moves the outputs into encOutputs. Fixed values and values that several
+  // outputs alias are copied, so this may be called only once, after run.
   void getOutputs(SEALValuation &encOutputs) {
-    for (auto &out : program.getOutputs()) {
-      std::visit(Overloaded{[&](const seal::Ciphertext &output) {
-                              encOutputs[out.first] = output;
-                            },
-                            [&](const seal::Plaintext &output) {
-                              encOutputs[out.first] = output;
-                            },
-                            [&](const std::vector<double> &output) {
-                              encOutputs[out.first] =
-                                  std::make_shared<DenseConstantValue>(
-                                      program.getVecSize(), output);
-                            }},
-                 Objects.at(out.second));
+    for (auto &[name, index] : program.getOutputs()) {
+      if (isFixed(index)) {
+        encOutputs[name] = operations.getOutput(valueOf(index));
+        continue;
+      }
+      // What remains of the uses of the operand are the outputs aliasing it
+      auto operand = program.getTerm(index).operandAt(0);
+      if (--remainingUses[operand] == 0) {
+        encOutputs[name] = operations.getOutput(std::move(values[operand]));
+      } else {
+        encOutputs[name] = operations.getOutput(values[operand]);
+      }
     }
   }
 };
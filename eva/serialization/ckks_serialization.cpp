@@ -4,6 +4,7 @@
 #include "eva/ckks/ckks_parameters.h"
 #include "eva/ckks/ckks_signature.h"
 #include "eva/serialization/ckks.pb.h"
+#include <algorithm>
 #include <memory>
 #include <utility>
 
@@ -32,6 +33,9 @@ unique_ptr<msg::CKKSParameters> serialize(const CKKSParameters &obj) {
   // Save the polynomial modulus degree
   msg->set_poly_modulus_degree(obj.polyModulusDegree);
 
+  // Save whether relinearization keys are needed
+  msg->set_no_relin_keys(!obj.needsRelinKeys);
+
   return msg;
 }
 
@@ -43,10 +47,32 @@ unique_ptr<CKKSParameters> deserialize(const msg::CKKSParameters &msg) {
   obj->primeBits = {msg.prime_bits().begin(), msg.prime_bits().end()};
   obj->rotations = {msg.rotations().begin(), msg.rotations().end()};
   obj->polyModulusDegree = msg.poly_modulus_degree();
+  obj->needsRelinKeys = !msg.no_relin_keys();
 
   return obj;
 }
 
+static void serializePackingInfos(
+    const unordered_map<string, CKKSPackingInfo> &infos,
+    google::protobuf::Map<string, msg::CKKSPackingInfo> &infosMap) {
+  for (auto &[key, info] : infos) {
+    auto &infoMsg = infosMap[key];
+    infoMsg.set_packed_name(info.packedName);
+    infoMsg.set_offset(info.offset);
+    infoMsg.set_packed_size(info.packedSize);
+  }
+}
+
+static unordered_map<string, CKKSPackingInfo> deserializePackingInfos(
+    const google::protobuf::Map<string, msg::CKKSPackingInfo> &infosMap) {
+  unordered_map<string, CKKSPackingInfo> infos;
+  for (auto &[key, infoMsg] : infosMap) {
+    infos.emplace(key, CKKSPackingInfo(infoMsg.packed_name(), infoMsg.offset(),
+                                       infoMsg.packed_size()));
+  }
+  return infos;
+}
+
 unique_ptr<msg::CKKSSignature> serialize(const CKKSSignature &obj) {
   // Create a new protobuf message
   auto msg = make_unique<msg::CKKSSignature>();
@@ -63,6 +89,19 @@ unique_ptr<msg::CKKSSignature> serialize(const CKKSSignature &obj) {
     infoMsg.set_level(info.level);
   }
 
+  // Save the layouts of packed inputs and outputs
+  serializePackingInfos(obj.packedInputs, *msg->mutable_packed_inputs());
+  serializePackingInfos(obj.packedOutputs, *msg->mutable_packed_outputs());
+
+  // Save the number of batched instances
+  msg->set_lanes(obj.lanes);
+
+  // Save the number of tiles each vector is split into
+  msg->set_tiles(obj.tiles);
+
+  // Save the stride of the slot layout
+  msg->set_stride(obj.stride);
+
   return msg;
 }
 
@@ -75,8 +114,14 @@ unique_ptr<CKKSSignature> deserialize(const msg::CKKSSignature &msg) {
                                     infoMsg.scale(), infoMsg.level()));
   }
 
-  // Return a new CKKSSignature object
-  return make_unique<CKKSSignature>(msg.vec_size(), move(inputs));
+  // Return a new CKKSSignature object. Signatures saved before batching,
+  // tiling or interleaving were supported have no lanes, tiles or stride set
+  // and hold a single instance contiguously in a single ciphertext.
+  return make_unique<CKKSSignature>(
+      msg.vec_size(), move(inputs),
+      deserializePackingInfos(msg.packed_inputs()),
+      deserializePackingInfos(msg.packed_outputs()), max(msg.lanes(), 1),
+      max(msg.tiles(), 1), max(msg.stride(), 1));
 }
 
 } // namespace eva
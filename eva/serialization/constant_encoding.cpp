@@ -0,0 +1,249 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "eva/serialization/constant_encoding.h"
+#include "eva/ir/attributes.h"
+#include "eva/util/logging.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <unordered_set>
+#include <utility>
+
+#ifdef EVA_USE_ZLIB
+#include <zlib.h>
+#endif
+
+using namespace std;
+
+namespace eva {
+
+double getQuantizationError(Term &term, AttributeKey key,
+                            const ConstantEncoding &encoding) {
+  if (encoding.quantization == ConstantQuantization::Double ||
+      !(encoding.maxError > 0) || term.op != Op::Constant ||
+      key != ConstantValueAttribute::key) {
+    return 0;
+  }
+
+  // Only constants that reach Encode terms unchanged are quantized, as their
+  // error then stays within maxError in the plaintexts. Negation and rotations
+  // move values without scaling any error, while other computations in the
+  // clear could scale it up before it is encoded.
+  uint32_t scale = 0;
+  unordered_set<Term *> visited;
+  vector<Term::Ptr> work = term.getUses();
+  if (work.empty()) {
+    return 0;
+  }
+  while (!work.empty()) {
+    auto use = move(work.back());
+    work.pop_back();
+    if (!visited.insert(use.get()).second) {
+      continue;
+    }
+    if (use->op == Op::Encode) {
+      if (use->has<EncodeAtScaleAttribute>()) {
+        scale = max(scale, use->get<EncodeAtScaleAttribute>());
+      }
+      continue;
+    }
+    if ((use->op != Op::Negate && use->op != Op::RotateLeftConst &&
+         use->op != Op::RotateRightConst) ||
+        use->numUses() == 0) {
+      return 0;
+    }
+    for (auto &next : use->getUses()) {
+      work.push_back(move(next));
+    }
+  }
+
+  // Encoding at scale rounds to multiples of 2^-scale, so a larger error shows
+  // in the plaintexts
+  double resolution = ldexp(1.0, -static_cast<int>(scale) - 1);
+  if (encoding.maxError > resolution) {
+    warn("Quantizing constant t%lu by up to %g is coarser than the rounding "
+         "of encoding it at scale %u, which is %g",
+         term.index, encoding.maxError, scale, resolution);
+  }
+  return encoding.maxError;
+}
+
+// Splits values into runs if that halves their number
+static bool encodeRuns(const vector<double> &values, vector<double> &runs,
+                       vector<uint32_t> &lengths) {
+  for (size_t i = 0; i < values.size(); ++i) {
+    if (i > 0 && values[i] == runs.back() &&
+        signbit(values[i]) == signbit(runs.back())) {
+      ++lengths.back();
+    } else {
+      runs.push_back(values[i]);
+      lengths.push_back(1);
+    }
+  }
+  return 2 * runs.size() <= values.size();
+}
+
+static bool quantizeFloat32(const vector<double> &values, double maxError,
+                            vector<float> &quantized) {
+  quantized.reserve(values.size());
+  for (double value : values) {
+    float rounded = static_cast<float>(value);
+    if (!(abs(rounded - value) <= maxError)) {
+      return false;
+    }
+    quantized.push_back(rounded);
+  }
+  return true;
+}
+
+// Uses the fewest fractional bits whose rounding error is at most maxError
+static bool quantizeFixedPoint(const vector<double> &values, double maxError,
+                               vector<int32_t> &quantized, int32_t &bits) {
+  bits = max(0, static_cast<int32_t>(ceil(-log2(2 * maxError))));
+  if (bits > 62) {
+    return false;
+  }
+  quantized.reserve(values.size());
+  for (double value : values) {
+    double scaled = round(ldexp(value, bits));
+    if (!(abs(scaled) <= numeric_limits<int32_t>::max())) {
+      return false;
+    }
+    quantized.push_back(static_cast<int32_t>(scaled));
+    if (!(abs(dequantizeFixedPoint(quantized.back(), bits) - value) <=
+          maxError)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void encodeConstant(msg::ConstantValue &msg, double maxError,
+                    const ConstantEncoding &encoding) {
+  if (msg.values_size() == 0) {
+    return;
+  }
+  vector<double> values(msg.values().begin(), msg.values().end());
+
+  // Runs are found before quantizing, so that quantization cannot merge runs
+  // of values that differ
+  if (encoding.runLength) {
+    vector<double> runs;
+    vector<uint32_t> lengths;
+    if (encodeRuns(values, runs, lengths)) {
+      values = move(runs);
+      msg.mutable_run_lengths()->Add(lengths.begin(), lengths.end());
+    }
+  }
+
+  vector<float> floats;
+  vector<int32_t> fixed;
+  int32_t bits;
+  msg.clear_values();
+  if (maxError > 0 &&
+      encoding.quantization == ConstantQuantization::Float32 &&
+      quantizeFloat32(values, maxError, floats)) {
+    msg.mutable_float_values()->Add(floats.begin(), floats.end());
+  } else if (maxError > 0 &&
+             encoding.quantization == ConstantQuantization::FixedPoint &&
+             quantizeFixedPoint(values, maxError, fixed, bits)) {
+    msg.mutable_fixed_values()->Add(fixed.begin(), fixed.end());
+    msg.set_fixed_point_bits(bits);
+  } else {
+    msg.mutable_values()->Add(values.begin(), values.end());
+  }
+}
+
+vector<double> decodeConstantValues(const msg::ConstantValue &msg) {
+  int encodings = (msg.values_size() > 0) + (msg.float_values_size() > 0) +
+                  (msg.fixed_values_size() > 0);
+  if (encodings > 1) {
+    throw runtime_error("Constant values stored in more than one encoding");
+  }
+
+  vector<double> values(msg.values().begin(), msg.values().end());
+  values.insert(values.end(), msg.float_values().begin(),
+                msg.float_values().end());
+  for (auto value : msg.fixed_values()) {
+    values.push_back(dequantizeFixedPoint(value, msg.fixed_point_bits()));
+  }
+
+  if (msg.run_lengths_size() == 0) {
+    return values;
+  }
+  if (msg.run_lengths_size() != values.size()) {
+    throw runtime_error("Values and run lengths count mismatch");
+  }
+  uint64_t total = 0;
+  for (auto length : msg.run_lengths()) {
+    if (length == 0) {
+      throw runtime_error("Constant runs must have non-zero length");
+    }
+    total += length;
+  }
+  if (total > msg.size()) {
+    throw runtime_error("Constant runs are longer than the constant");
+  }
+  vector<double> expanded;
+  expanded.reserve(total);
+  for (size_t i = 0; i < values.size(); ++i) {
+    expanded.insert(expanded.end(), msg.run_lengths(i), values[i]);
+  }
+  return expanded;
+}
+
+#ifdef EVA_USE_ZLIB
+
+string compress(const string &data) {
+  uLongf size = compressBound(data.size());
+  string out(size, '\0');
+  if (compress2(reinterpret_cast<Bytef *>(&out[0]), &size,
+                reinterpret_cast<const Bytef *>(data.data()), data.size(),
+                Z_BEST_COMPRESSION) != Z_OK) {
+    throw runtime_error("Could not compress data");
+  }
+  out.resize(size);
+  return out;
+}
+
+string decompress(const string &data) {
+  z_stream stream = {};
+  if (inflateInit(&stream) != Z_OK) {
+    throw runtime_error("Could not decompress data");
+  }
+  stream.next_in =
+      reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+  stream.avail_in = static_cast<uInt>(data.size());
+
+  string out;
+  char buffer[1 << 16];
+  int status;
+  do {
+    stream.next_out = reinterpret_cast<Bytef *>(buffer);
+    stream.avail_out = sizeof(buffer);
+    status = inflate(&stream, Z_NO_FLUSH);
+    if (status != Z_OK && status != Z_STREAM_END) {
+      inflateEnd(&stream);
+      throw runtime_error("Could not decompress data");
+    }
+    out.append(buffer, sizeof(buffer) - stream.avail_out);
+  } while (status != Z_STREAM_END);
+  inflateEnd(&stream);
+  return out;
+}
+
+#else
+
+string compress(const string &data) {
+  throw runtime_error("EVA was built without zlib");
+}
+
+string decompress(const string &data) {
+  throw runtime_error("EVA was built without zlib");
+}
+
+#endif
+
+} // namespace eva
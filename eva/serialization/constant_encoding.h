@@ -0,0 +1,59 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include "eva/ir/term.h"
+#include "eva/serialization/eva.pb.h"
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace eva {
+
+enum class ConstantQuantization { Double, Float32, FixedPoint };
+
+// Encodings for the constants of saved programs. All are off by default, which
+// stores every value of every constant as a double.
+struct ConstantEncoding {
+  // Store equal constants once for all terms holding them
+  bool deduplicate = false;
+  // Store runs of equal values, as found in masks, as a value and a length
+  bool runLength = false;
+  // Store the values of constants that are only encoded into plaintexts, at
+  // most negated or rotated on the way, with fewer bits. No value changes by
+  // more than maxError, and nothing is quantized while it is zero; constants
+  // that need more bits are stored exactly. A warning is given for constants
+  // for which maxError is coarser than the rounding of encoding them at the
+  // largest scale they are encoded at.
+  ConstantQuantization quantization = ConstantQuantization::Double;
+  double maxError = 0;
+  // Compress the whole program with zlib. Not available for the flat format,
+  // as its constants are used in place.
+  bool compress = false;
+};
+
+// Returns the largest change quantization may make to the values of a term
+// holding a constant, which is at most encoding.maxError, or zero if they must
+// be stored exactly
+double getQuantizationError(Term &term, AttributeKey key,
+                            const ConstantEncoding &encoding);
+
+// Rewrites the values of msg in the encodings selected, quantizing them only if
+// maxError is positive
+void encodeConstant(msg::ConstantValue &msg, double maxError,
+                    const ConstantEncoding &encoding);
+
+// Returns the values of msg in any encoding, without repeating them to its size
+std::vector<double> decodeConstantValues(const msg::ConstantValue &msg);
+
+inline double dequantizeFixedPoint(std::int32_t value, std::int32_t bits) {
+  return std::ldexp(static_cast<double>(value), -bits);
+}
+
+// These throw if EVA was built without zlib
+std::string compress(const std::string &data);
+std::string decompress(const std::string &data);
+
+} // namespace eva
@@ -8,6 +8,9 @@
 namespace eva {
 
 // Bump the version for any changes that break serialization
-const std::int32_t EVA_FORMAT_VERSION = 2;
+const std::int32_t EVA_FORMAT_VERSION = 3;
+
+// The oldest version that can still be loaded
+const std::int32_t EVA_MIN_FORMAT_VERSION = 2;
 
 } // namespace eva
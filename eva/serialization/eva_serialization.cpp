@@ -4,6 +4,7 @@
 #include "eva/ir/attribute_list.h"
 #include "eva/ir/program.h"
 #include "eva/ir/term_map.h"
+#include "eva/serialization/constant_encoding.h"
 #include "eva/serialization/eva_format_version.h"
 #include "eva/util/overloaded.h"
 #include <cstddef>
@@ -12,6 +13,7 @@
 #include <memory>
 #include <stack>
 #include <stdexcept>
+#include <string>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -24,6 +26,12 @@ namespace eva {
 // The function definition is here so that all serialization code is together
 // and not spread out throughout the project
 void AttributeList::loadAttribute(const msg::Attribute &msg) {
+  loadAttribute(msg, {});
+}
+
+void AttributeList::loadAttribute(
+    const msg::Attribute &msg,
+    const vector<shared_ptr<ConstantValue>> &constants) {
   // Load the attribute key; this encodes the type of the attribute
   AttributeKey key = static_cast<AttributeKey>(msg.key());
 
@@ -44,8 +52,18 @@ void AttributeList::loadAttribute(const msg::Attribute &msg) {
     value.emplace<Type>(static_cast<Type>(msg.type()));
     break;
   case msg::Attribute::kConstantValue:
-    // The attribute holds a constant value; load it
-    value.emplace<shared_ptr<ConstantValue>>(deserialize(msg.constant_value()));
+    // The attribute holds a constant value; load it or share one of the
+    // program's constants
+    if (msg.constant_value().blob() != 0) {
+      if (msg.constant_value().blob() > constants.size()) {
+        throw runtime_error("Shared constant out of bounds");
+      }
+      value.emplace<shared_ptr<ConstantValue>>(
+          constants[msg.constant_value().blob() - 1]);
+    } else {
+      value.emplace<shared_ptr<ConstantValue>>(
+          deserialize(msg.constant_value()));
+    }
     break;
   case msg::Attribute::VALUE_NOT_SET:
     // No value is set; set the attribute to std::monostate
@@ -113,37 +131,42 @@ shared_ptr<ConstantValue> deserialize(const msg::ConstantValue &msg) {
   if (msg.size() == 0) {
     throw runtime_error("Constant must have non-zero size");
   }
+  if (msg.blob() != 0) {
+    throw runtime_error("Shared constant outside of a program");
+  }
 
+  // Decode the values from whichever encoding they were saved in
   size_t size = msg.size();
-  if (msg.values_size() == 0) {
+  vector<double> values = decodeConstantValues(msg);
+  if (values.size() == 0) {
     // Zero size; return a sparse zero constant
     return make_shared<SparseConstantValue>(size,
                                             vector<pair<uint32_t, double>>{});
   } else if (msg.sparse_indices_size() == 0) {
     // No sparse indices so this is a dense constant
-    vector<double> values(msg.values().begin(), msg.values().end());
     return make_shared<DenseConstantValue>(size, move(values));
   } else {
     // Must be a sparse constant; check that the data is consistent
-    if (msg.sparse_indices_size() != msg.values_size()) {
+    if (msg.sparse_indices_size() != values.size()) {
       throw runtime_error("Values and sparse indices count mismatch");
     }
 
     // Load the sparse representation
-    vector<pair<uint32_t, double>> values;
-    auto indexIter = msg.sparse_indices().begin();
-    auto valueIter = msg.values().begin();
-    while (indexIter != msg.sparse_indices().end()) {
-      values.emplace_back(*indexIter, *valueIter);
-      ++indexIter;
-      ++valueIter;
+    vector<pair<uint32_t, double>> sparseValues;
+    for (size_t i = 0; i < values.size(); ++i) {
+      sparseValues.emplace_back(msg.sparse_indices(i), values[i]);
     }
 
-    return make_shared<SparseConstantValue>(size, move(values));
+    return make_shared<SparseConstantValue>(size, move(sparseValues));
   }
 }
 
 unique_ptr<msg::Program> serialize(const Program &obj) {
+  return serialize(obj, ConstantEncoding());
+}
+
+unique_ptr<msg::Program> serialize(const Program &obj,
+                                   const ConstantEncoding &encoding) {
   // Create a new program message for serialization
   auto msg = make_unique<msg::Program>();
 
@@ -164,6 +187,11 @@ unique_ptr<msg::Program> serialize(const Program &obj) {
   // Index to be assigned next
   uint64_t nextIndex = 0;
 
+  // Attributes holding each distinct constant, indexed by the encoded message
+  // of the constant
+  unordered_map<string, size_t> constantIndices;
+  vector<vector<msg::Attribute *>> constantAttributes;
+
   // Work stack of terms that need to be processed
   // The bool ("visit") signals whether the operands of the term have already
   // been processed. If this is false, we are ready to give the term an index.
@@ -219,6 +247,41 @@ unique_ptr<msg::Program> serialize(const Program &obj) {
 
       // Save the attributes for this term
       term->serializeAttributes([&]() { return termMsg->add_attributes(); });
+
+      // Encode the constants of this term and find equal ones if
+      // deduplicating
+      for (auto &attribute : *termMsg->mutable_attributes()) {
+        if (!attribute.has_constant_value()) {
+          continue;
+        }
+        auto constant = attribute.mutable_constant_value();
+        encodeConstant(*constant,
+                       getQuantizationError(
+                           *term, static_cast<AttributeKey>(attribute.key()),
+                           encoding),
+                       encoding);
+        if (encoding.deduplicate) {
+          auto [entry, added] = constantIndices.emplace(
+              constant->SerializeAsString(), constantAttributes.size());
+          if (added) {
+            constantAttributes.emplace_back();
+          }
+          constantAttributes[entry->second].push_back(&attribute);
+        }
+      }
+    }
+  }
+
+  // Move the constants held by more than one term into the program
+  for (auto &attributes : constantAttributes) {
+    if (attributes.size() < 2) {
+      continue;
+    }
+    msg->mutable_constants()->AddAllocated(
+        attributes[0]->release_constant_value());
+    for (auto attribute : attributes) {
+      attribute->mutable_constant_value()->Clear();
+      attribute->mutable_constant_value()->set_blob(msg->constants_size());
     }
   }
 
@@ -236,15 +299,49 @@ unique_ptr<msg::Program> serialize(const Program &obj) {
     termNameMsg->set_term(indices.at(entry.second.get()));
   }
 
+  // Save the functions called by the program; they are compressed along with
+  // the program
+  auto functionEncoding = encoding;
+  functionEncoding.compress = false;
+  for (const auto &function : obj.functions) {
+    msg->mutable_functions()->AddAllocated(
+        serialize(*function, functionEncoding).release());
+  }
+
+  // Compress everything into a program holding only the version
+  if (encoding.compress) {
+    auto compressed = make_unique<msg::Program>();
+    compressed->set_ir_version(EVA_FORMAT_VERSION);
+    compressed->set_compressed(compress(msg->SerializeAsString()));
+    return compressed;
+  }
+
   return msg;
 }
 
 unique_ptr<Program> deserialize(const msg::Program &msg) {
   // Ensure serialization version is compatible
-  if (msg.ir_version() != EVA_FORMAT_VERSION) {
+  if (msg.ir_version() < EVA_MIN_FORMAT_VERSION ||
+      msg.ir_version() > EVA_FORMAT_VERSION) {
     throw runtime_error("Serialization format version mismatch");
   }
 
+  // Load a compressed program from the program it holds
+  if (!msg.compressed().empty()) {
+    msg::Program inner;
+    if (!inner.ParseFromString(decompress(msg.compressed())) ||
+        !inner.compressed().empty()) {
+      throw runtime_error("Could not parse compressed program");
+    }
+    return deserialize(inner);
+  }
+
+  // Load the constants shared by terms
+  vector<shared_ptr<ConstantValue>> constants;
+  for (auto &constant : msg.constants()) {
+    constants.emplace_back(deserialize(constant));
+  }
+
   // Create a new program with the loaded name and vector size
   auto obj = make_unique<Program>(msg.name(), msg.vec_size());
 
@@ -271,7 +368,7 @@ unique_ptr<Program> deserialize(const msg::Program &msg) {
 
     // Load attributes for this term
     for (auto &attribute : term.attributes()) {
-      terms.back()->loadAttribute(attribute);
+      terms.back()->loadAttribute(attribute, constants);
     }
   }
 
@@ -285,6 +382,11 @@ unique_ptr<Program> deserialize(const msg::Program &msg) {
     obj->outputs.emplace(out.name(), terms.at(out.term()));
   }
 
+  // Load the functions called by the program
+  for (auto &function : msg.functions()) {
+    obj->functions.emplace_back(deserialize(function));
+  }
+
   return obj;
 }
 
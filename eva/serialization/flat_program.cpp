@@ -0,0 +1,489 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "eva/serialization/flat_program.h"
+#include "eva/common/program_traversal.h"
+#include "eva/ir/term_map.h"
+#include "eva/serialization/eva_format_version.h"
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+using namespace std;
+
+namespace eva {
+
+static const char FLAT_PROGRAM_MAGIC[8] = {'E', 'V', 'A', 'F', 'L', 'A', 'T', 0};
+static const uint32_t FLAT_PROGRAM_BYTE_ORDER = 0x01020304;
+
+// Appends the elements of values at the next multiple of alignment and returns
+// where they start
+template <class T>
+static uint64_t appendSection(string &out, const vector<T> &values,
+                              size_t alignment) {
+  out.resize((out.size() + alignment - 1) / alignment * alignment);
+  uint64_t offset = out.size();
+  out.append(reinterpret_cast<const char *>(values.data()),
+             values.size() * sizeof(T));
+  return offset;
+}
+
+// Returns the number of operands terms with op take, or -1 for ops that flat
+// programs cannot hold
+static int getOperandCount(Op op) {
+  switch (op) {
+  case Op::Input:
+  case Op::Constant:
+    return 0;
+  case Op::Add:
+  case Op::Sub:
+  case Op::Mul:
+    return 2;
+  case Op::Output:
+  case Op::Negate:
+  case Op::RotateLeftConst:
+  case Op::RotateRightConst:
+  case Op::Permute:
+  case Op::Relinearize:
+  case Op::ModSwitch:
+  case Op::Rescale:
+  case Op::Encode:
+    return 1;
+  default:
+    return -1;
+  }
+}
+
+string flatten(Program &program, const ConstantEncoding &encoding) {
+  if (!program.getFunctions().empty()) {
+    throw runtime_error("Programs with functions must be compiled before "
+                        "they can be flattened");
+  }
+  if (encoding.compress) {
+    throw runtime_error("Flat programs cannot be compressed");
+  }
+
+  vector<FlatTerm> terms;
+  vector<uint32_t> operands;
+  vector<FlatAttribute> attributes;
+  vector<uint32_t> words;
+  vector<double> constants;
+
+  // Constants already written, keyed by their encoded messages
+  unordered_map<string, FlatAttribute> sharedConstants;
+
+  // Terms are numbered in the order of a forward pass, which is topological.
+  // Attributes are read through their protobuf messages, which are the only
+  // way to get at the values of constants, and constants are encoded as they
+  // are for the protobuf format.
+  TermMap<uint32_t> order(program);
+  ProgramTraversal(program).forwardPass([&](Term::Ptr &term) {
+    order[term] = static_cast<uint32_t>(terms.size());
+    FlatTerm flatTerm = {};
+    flatTerm.op = static_cast<uint32_t>(term->op);
+    flatTerm.operandCount = static_cast<uint32_t>(term->numOperands());
+    flatTerm.firstOperand = static_cast<uint32_t>(operands.size());
+    for (auto &operand : term->getOperands()) {
+      operands.push_back(order[operand]);
+    }
+
+    flatTerm.firstAttribute = static_cast<uint32_t>(attributes.size());
+    vector<msg::Attribute> attributeMsgs;
+    term->serializeAttributes([&]() { return &attributeMsgs.emplace_back(); });
+    for (auto &msg : attributeMsgs) {
+      FlatAttribute attribute = {};
+      attribute.key = msg.key();
+      switch (msg.value_case()) {
+      case msg::Attribute::kUint32:
+        attribute.kind = FlatAttribute::Uint32;
+        attribute.value = msg.uint32();
+        break;
+      case msg::Attribute::kInt32:
+        attribute.kind = FlatAttribute::Int32;
+        attribute.value = static_cast<uint32_t>(msg.int32());
+        break;
+      case msg::Attribute::kType:
+        attribute.kind = FlatAttribute::TypeValue;
+        attribute.value = msg.type();
+        break;
+      case msg::Attribute::kConstantValue: {
+        auto &constant = *msg.mutable_constant_value();
+        encodeConstant(constant,
+                       getQuantizationError(
+                           *term, static_cast<AttributeKey>(msg.key()),
+                           encoding),
+                       encoding);
+        string sharedKey;
+        if (encoding.deduplicate) {
+          sharedKey = constant.SerializeAsString();
+          auto shared = sharedConstants.find(sharedKey);
+          if (shared != sharedConstants.end()) {
+            attribute = shared->second;
+            attribute.key = msg.key();
+            break;
+          }
+        }
+
+        uint32_t stored = constant.values_size() +
+                          constant.float_values_size() +
+                          constant.fixed_values_size();
+        uint64_t count = stored;
+        if (constant.run_lengths_size() > 0) {
+          count = 0;
+          for (auto length : constant.run_lengths()) {
+            count += length;
+          }
+          attribute.runCount = stored;
+        }
+        bool sparse = count == 0 || constant.sparse_indices_size() > 0;
+        attribute.kind = sparse ? FlatAttribute::SparseConstant
+                                : FlatAttribute::DenseConstant;
+        attribute.value = constant.size();
+        attribute.count = static_cast<uint32_t>(count);
+
+        if (constant.float_values_size() > 0) {
+          attribute.storage = FlatAttribute::Float32;
+          attribute.offset = words.size();
+          for (float value : constant.float_values()) {
+            uint32_t word;
+            memcpy(&word, &value, sizeof(word));
+            words.push_back(word);
+          }
+        } else if (constant.fixed_values_size() > 0) {
+          attribute.storage = FlatAttribute::FixedPoint;
+          attribute.fixedPointBits = constant.fixed_point_bits();
+          attribute.offset = words.size();
+          for (int32_t value : constant.fixed_values()) {
+            words.push_back(static_cast<uint32_t>(value));
+          }
+        } else {
+          attribute.storage = FlatAttribute::Double;
+          attribute.offset = constants.size();
+          constants.insert(constants.end(), constant.values().begin(),
+                           constant.values().end());
+        }
+        attribute.runOffset = words.size();
+        words.insert(words.end(), constant.run_lengths().begin(),
+                     constant.run_lengths().end());
+        attribute.indexOffset = words.size();
+        words.insert(words.end(), constant.sparse_indices().begin(),
+                     constant.sparse_indices().end());
+
+        if (encoding.deduplicate) {
+          sharedConstants.emplace(move(sharedKey), attribute);
+        }
+      } break;
+      default:
+        attribute.kind = FlatAttribute::Empty;
+      }
+      attributes.push_back(attribute);
+    }
+    flatTerm.attributeCount =
+        static_cast<uint32_t>(attributes.size() - flatTerm.firstAttribute);
+    terms.push_back(flatTerm);
+  });
+
+  // The program name comes first, then the inputs and then the outputs
+  vector<pair<uint32_t, string>> namedTerms;
+  namedTerms.emplace_back(0, program.getName());
+  for (auto &[name, term] : program.getInputs()) {
+    namedTerms.emplace_back(order[term], name);
+  }
+  for (auto &[name, term] : program.getOutputs()) {
+    namedTerms.emplace_back(order[term], name);
+  }
+
+  FlatHeader header = {};
+  memcpy(header.magic, FLAT_PROGRAM_MAGIC, sizeof(header.magic));
+  header.byteOrder = FLAT_PROGRAM_BYTE_ORDER;
+  header.version = EVA_FORMAT_VERSION;
+  header.vecSize = static_cast<uint32_t>(program.getVecSize());
+  header.termCount = static_cast<uint32_t>(terms.size());
+  header.inputCount = static_cast<uint32_t>(program.getInputs().size());
+  header.outputCount = static_cast<uint32_t>(program.getOutputs().size());
+  header.operandCount = operands.size();
+  header.attributeCount = attributes.size();
+  header.wordCount = words.size();
+  header.constantCount = constants.size();
+
+  string out(sizeof(FlatHeader), '\0');
+  header.termsOffset = appendSection(out, terms, alignof(FlatTerm));
+  header.operandsOffset = appendSection(out, operands, alignof(uint32_t));
+  header.attributesOffset =
+      appendSection(out, attributes, alignof(FlatAttribute));
+
+  // The characters of the names follow their records
+  vector<FlatName> names(namedTerms.size());
+  header.namesOffset = appendSection(out, names, alignof(FlatName));
+  for (size_t i = 0; i < namedTerms.size(); ++i) {
+    names[i].term = namedTerms[i].first;
+    names[i].length = static_cast<uint32_t>(namedTerms[i].second.size());
+    names[i].offset = out.size();
+    out += namedTerms[i].second;
+  }
+  memcpy(&out[header.namesOffset], names.data(),
+         names.size() * sizeof(FlatName));
+
+  header.wordsOffset = appendSection(out, words, alignof(uint32_t));
+  header.constantsOffset =
+      appendSection(out, constants, FLAT_PROGRAM_ALIGNMENT);
+  out.resize((out.size() + FLAT_PROGRAM_ALIGNMENT - 1) /
+             FLAT_PROGRAM_ALIGNMENT * FLAT_PROGRAM_ALIGNMENT);
+  header.size = out.size();
+  memcpy(&out[0], &header, sizeof(FlatHeader));
+  return out;
+}
+
+// Checks that count elements of T starting at offset lie within size bytes and
+// are aligned for T
+template <class T>
+static void checkSection(uint64_t offset, uint64_t count, size_t size) {
+  if (offset % alignof(T) != 0 || offset > size ||
+      count > (size - offset) / sizeof(T)) {
+    throw runtime_error("Flat program section out of bounds");
+  }
+}
+
+// Checks that count elements starting at offset lie within a section of size
+// elements
+static bool inSection(uint64_t offset, uint64_t count, uint64_t size) {
+  return offset <= size && count <= size - offset;
+}
+
+FlatProgram::FlatProgram(shared_ptr<const void> storage, size_t size)
+    : storage(move(storage)) {
+  auto data = static_cast<const char *>(this->storage.get());
+  if (size < sizeof(FlatHeader)) {
+    throw runtime_error("Not a flat program");
+  }
+  header = reinterpret_cast<const FlatHeader *>(data);
+  if (memcmp(header->magic, FLAT_PROGRAM_MAGIC, sizeof(header->magic)) != 0) {
+    throw runtime_error("Not a flat program");
+  }
+  if (header->byteOrder != FLAT_PROGRAM_BYTE_ORDER) {
+    throw runtime_error("Flat program was written with another byte order");
+  }
+  if (header->version != EVA_FORMAT_VERSION) {
+    throw runtime_error("Serialization format version mismatch");
+  }
+
+  uint64_t nameCount = 1 + uint64_t(header->inputCount) + header->outputCount;
+  checkSection<FlatTerm>(header->termsOffset, header->termCount, size);
+  checkSection<uint32_t>(header->operandsOffset, header->operandCount, size);
+  checkSection<FlatAttribute>(header->attributesOffset,
+                              header->attributeCount, size);
+  checkSection<FlatName>(header->namesOffset, nameCount, size);
+  checkSection<uint32_t>(header->wordsOffset, header->wordCount, size);
+  checkSection<double>(header->constantsOffset, header->constantCount, size);
+  terms = reinterpret_cast<const FlatTerm *>(data + header->termsOffset);
+  operands = reinterpret_cast<const uint32_t *>(data + header->operandsOffset);
+  attributes =
+      reinterpret_cast<const FlatAttribute *>(data + header->attributesOffset);
+  words = reinterpret_cast<const uint32_t *>(data + header->wordsOffset);
+  constants = reinterpret_cast<const double *>(data + header->constantsOffset);
+
+  // Check every reference once, so that executing needs no checks
+  for (uint32_t i = 0; i < header->termCount; ++i) {
+    auto &term = terms[i];
+    if (!isValidOp(static_cast<Op>(term.op))) {
+      throw runtime_error("Invalid op encountered");
+    }
+    if (getOperandCount(static_cast<Op>(term.op)) !=
+        static_cast<int64_t>(term.operandCount)) {
+      throw runtime_error("Flat program term has the wrong number of operands");
+    }
+    if (term.firstOperand + uint64_t(term.operandCount) >
+        header->operandCount) {
+      throw runtime_error("Flat program operands out of bounds");
+    }
+    for (uint32_t j = 0; j < term.operandCount; ++j) {
+      if (operands[term.firstOperand + j] >= i) {
+        throw runtime_error("Flat program terms are not in topological order");
+      }
+    }
+    if (term.firstAttribute + uint64_t(term.attributeCount) >
+        header->attributeCount) {
+      throw runtime_error("Flat program attributes out of bounds");
+    }
+  }
+  for (uint64_t i = 0; i < header->attributeCount; ++i) {
+    auto &attribute = attributes[i];
+    AttributeValue value;
+    switch (attribute.kind) {
+    case FlatAttribute::Empty:
+      break;
+    case FlatAttribute::Uint32:
+      value = attribute.value;
+      break;
+    case FlatAttribute::Int32:
+      value = static_cast<int32_t>(attribute.value);
+      break;
+    case FlatAttribute::TypeValue:
+      value = static_cast<Type>(attribute.value);
+      break;
+    case FlatAttribute::DenseConstant:
+    case FlatAttribute::SparseConstant: {
+      value = shared_ptr<ConstantValue>();
+      bool dense = attribute.kind == FlatAttribute::DenseConstant;
+      uint32_t stored = attribute.runCount != 0 ? attribute.runCount
+                                                : attribute.count;
+      if (attribute.value == 0 ||
+          (dense && (attribute.count == 0 ||
+                     attribute.value % attribute.count != 0)) ||
+          attribute.storage > FlatAttribute::FixedPoint ||
+          !inSection(attribute.offset, stored,
+                     attribute.storage == FlatAttribute::Double
+                         ? header->constantCount
+                         : header->wordCount) ||
+          !inSection(attribute.runOffset, attribute.runCount,
+                     header->wordCount) ||
+          (!dense && !inSection(attribute.indexOffset, attribute.count,
+                                header->wordCount))) {
+        throw runtime_error("Invalid constant in flat program");
+      }
+      for (uint32_t j = 0; !dense && j < attribute.count; ++j) {
+        if (words[attribute.indexOffset + j] >= attribute.value) {
+          throw runtime_error("Invalid constant in flat program");
+        }
+      }
+      uint64_t runTotal = 0;
+      for (uint32_t j = 0; j < attribute.runCount; ++j) {
+        auto length = words[attribute.runOffset + j];
+        if (length == 0) {
+          throw runtime_error("Invalid constant in flat program");
+        }
+        runTotal += length;
+      }
+      if (attribute.runCount != 0 && runTotal != attribute.count) {
+        throw runtime_error("Invalid constant in flat program");
+      }
+    } break;
+    default:
+      throw runtime_error("Unknown attribute type");
+    }
+    if (attribute.key > numeric_limits<AttributeKey>::max() ||
+        !isValidAttribute(static_cast<AttributeKey>(attribute.key), value)) {
+      throw runtime_error("Invalid attribute encountered");
+    }
+  }
+
+  auto names = reinterpret_cast<const FlatName *>(data + header->namesOffset);
+  for (uint64_t i = 0; i < nameCount; ++i) {
+    if (names[i].offset > size || names[i].length > size - names[i].offset ||
+        (i > 0 && names[i].term >= header->termCount)) {
+      throw runtime_error("Flat program names out of bounds");
+    }
+    string name(data + names[i].offset, names[i].length);
+    if (i == 0) {
+      this->name = move(name);
+    } else if (i <= header->inputCount) {
+      if (static_cast<Op>(terms[names[i].term].op) != Op::Input) {
+        throw runtime_error("Flat program input " + name +
+                            " is not an Input term");
+      }
+      inputs.emplace(move(name), names[i].term);
+    } else {
+      if (static_cast<Op>(terms[names[i].term].op) != Op::Output) {
+        throw runtime_error("Flat program output " + name +
+                            " is not an Output term");
+      }
+      outputs.emplace(move(name), names[i].term);
+    }
+  }
+}
+
+FlatProgram::FlatProgram(const string &bytes)
+    : FlatProgram(copyToAlignedMemory(bytes)) {}
+
+FlatProgram::FlatProgram(MappedFile memory)
+    : FlatProgram(move(memory.data), memory.size) {}
+
+unique_ptr<FlatProgram> FlatProgram::map(const string &path) {
+  return make_unique<FlatProgram>(mapFile(path));
+}
+
+const FlatAttribute *
+FlatProgram::TermView::find(AttributeKey key) const {
+  auto first = program->attributes + term->firstAttribute;
+  for (uint32_t i = 0; i < term->attributeCount; ++i) {
+    if (first[i].key == key) return first + i;
+  }
+  return nullptr;
+}
+
+const FlatAttribute *FlatProgram::TermView::get(AttributeKey key) const {
+  auto attribute = find(key);
+  if (!attribute) {
+    throw out_of_range("Attribute not in list: " + getAttributeName(key));
+  }
+  return attribute;
+}
+
+void FlatProgram::TermView::expandConstant(vector<double> &result,
+                                           size_t slots) const {
+  auto attribute = get(ConstantValueAttribute::key);
+  size_t size = attribute->value;
+  if (slots < size) {
+    throw runtime_error("Slots must be at least size of constant");
+  }
+  if (slots % size != 0) {
+    throw runtime_error("Size must exactly divide slots");
+  }
+
+  // Decode the values unless they are doubles that can be used in place
+  const double *values = program->constants + attribute->offset;
+  vector<double> decoded;
+  if (attribute->storage != FlatAttribute::Double ||
+      attribute->runCount != 0) {
+    decoded.reserve(attribute->count);
+    if (attribute->runCount == 0) {
+      for (uint32_t j = 0; j < attribute->count; ++j) {
+        decoded.push_back(program->getStoredValue(*attribute, j));
+      }
+    } else {
+      auto lengths = program->words + attribute->runOffset;
+      for (uint32_t j = 0; j < attribute->runCount; ++j) {
+        decoded.insert(decoded.end(), lengths[j],
+                       program->getStoredValue(*attribute, j));
+      }
+    }
+    values = decoded.data();
+  }
+
+  if (attribute->kind == FlatAttribute::DenseConstant) {
+    result.clear();
+    result.reserve(slots);
+    for (size_t r = slots / attribute->count; r > 0; --r) {
+      result.insert(result.end(), values, values + attribute->count);
+    }
+  } else {
+    auto slotIndices = program->words + attribute->indexOffset;
+    result.assign(slots, 0);
+    for (uint32_t j = 0; j < attribute->count; ++j) {
+      for (size_t i = slotIndices[j]; i < slots; i += size) {
+        result[i] = values[j];
+      }
+    }
+  }
+}
+
+double FlatProgram::getStoredValue(const FlatAttribute &attribute,
+                                   size_t i) const {
+  switch (attribute.storage) {
+  case FlatAttribute::Float32: {
+    float value;
+    memcpy(&value, words + attribute.offset + i, sizeof(value));
+    return value;
+  }
+  case FlatAttribute::FixedPoint:
+    return dequantizeFixedPoint(
+        static_cast<int32_t>(words[attribute.offset + i]),
+        attribute.fixedPointBits);
+  default:
+    return constants[attribute.offset + i];
+  }
+}
+
+} // namespace eva
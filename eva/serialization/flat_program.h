@@ -0,0 +1,200 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include "eva/ir/attributes.h"
+#include "eva/ir/ops.h"
+#include "eva/ir/program.h"
+#include "eva/serialization/constant_encoding.h"
+#include "eva/util/mapped_file.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace eva {
+
+/*
+The flat program format holds a program in a few arrays of fixed size records
+that are used in place, so that a program can be memory mapped and executed
+without parsing it or building terms. The file starts with a FlatHeader, which
+gives the offsets of these sections:
+
+- terms: a FlatTerm for each term, in topological order
+- operands: the indices of the operands of all terms
+- attributes: a FlatAttribute for each attribute of each term
+- names: a FlatName for the program, each input and each output, and the
+  characters of the names
+- words: 32-bit words holding the slots of sparse constants, the lengths of
+  runs of values and values quantized to 32 bits
+- constants: the values of constants stored as doubles, starting at a multiple
+  of FLAT_PROGRAM_ALIGNMENT bytes
+
+Constants are written with the encodings selected by a ConstantEncoding, except
+for compression. Deduplicated constants share their values.
+
+Numbers are in the byte order of the machine that wrote the file, which is
+checked when the file is opened. Programs with functions must have their calls
+expanded, which compiling does, before they can be flattened.
+*/
+
+const std::size_t FLAT_PROGRAM_ALIGNMENT = 64;
+
+struct FlatHeader {
+  char magic[8];
+  std::uint32_t byteOrder;
+  std::uint32_t version;
+  std::uint32_t vecSize;
+  std::uint32_t termCount;
+  std::uint32_t inputCount;
+  std::uint32_t outputCount;
+  std::uint64_t operandCount;
+  std::uint64_t attributeCount;
+  std::uint64_t wordCount;
+  std::uint64_t constantCount;
+  std::uint64_t termsOffset;
+  std::uint64_t operandsOffset;
+  std::uint64_t attributesOffset;
+  std::uint64_t namesOffset;
+  std::uint64_t wordsOffset;
+  std::uint64_t constantsOffset;
+  std::uint64_t size;
+};
+
+struct FlatTerm {
+  std::uint32_t op;
+  std::uint32_t operandCount;
+  std::uint32_t firstOperand;
+  std::uint32_t attributeCount;
+  std::uint32_t firstAttribute;
+  std::uint32_t reserved;
+};
+
+struct FlatAttribute {
+  enum Kind : std::uint32_t {
+    Empty,
+    Uint32,
+    Int32,
+    TypeValue,
+    DenseConstant,
+    SparseConstant
+  };
+
+  enum Storage : std::uint32_t { Double, Float32, FixedPoint };
+
+  std::uint32_t key;
+  std::uint32_t kind;
+  // The value of scalar attributes, or the size of constants
+  std::uint32_t value;
+  // The number of values of constants. For sparse constants their slots start
+  // at indexOffset in the words section.
+  std::uint32_t count;
+  std::uint64_t indexOffset;
+  // The values start at offset in the constants section if stored as doubles,
+  // and in the words section otherwise. If runCount is non-zero then runCount
+  // values are stored, each repeated by a length starting at runOffset in the
+  // words section.
+  std::uint64_t offset;
+  std::uint64_t runOffset;
+  std::uint32_t runCount;
+  std::uint32_t storage;
+  std::int32_t fixedPointBits;
+  std::uint32_t reserved;
+};
+
+// Names are at offset from the start of the file
+struct FlatName {
+  std::uint32_t term;
+  std::uint32_t length;
+  std::uint64_t offset;
+};
+
+// Writes program in the flat format
+std::string flatten(Program &program,
+                    const ConstantEncoding &encoding = ConstantEncoding());
+
+// A read-only view of a program in the flat format, which keeps the memory
+// holding it alive. The format is validated when the view is created.
+class FlatProgram {
+public:
+  class TermView {
+  public:
+    Op getOp() const { return static_cast<Op>(term->op); }
+    std::uint32_t getIndex() const { return index; }
+    std::size_t numOperands() const { return term->operandCount; }
+    std::uint32_t operandAt(std::size_t i) const {
+      return program->operands[term->firstOperand + i];
+    }
+
+    template <class TAttr> bool has() const { return find(TAttr::key); }
+
+    // Scalar attributes only; constants are expanded with expandConstant
+    template <class TAttr> typename TAttr::Value get() const {
+      static_assert(std::is_same_v<typename TAttr::Value, std::uint32_t> ||
+                        std::is_same_v<typename TAttr::Value, std::int32_t> ||
+                        std::is_same_v<typename TAttr::Value, Type>,
+                    "Only scalar attributes can be read from flat programs");
+      return static_cast<typename TAttr::Value>(get(TAttr::key)->value);
+    }
+
+    // Expands the ConstantValueAttribute of this term to slots elements, as
+    // ConstantValue::expandTo does
+    void expandConstant(std::vector<double> &result, std::size_t slots) const;
+
+  private:
+    const FlatProgram *program;
+    const FlatTerm *term;
+    std::uint32_t index;
+
+    TermView(const FlatProgram *p, std::uint32_t i)
+        : program(p), term(p->terms + i), index(i) {}
+
+    const FlatAttribute *find(AttributeKey key) const;
+    const FlatAttribute *get(AttributeKey key) const;
+
+    friend class FlatProgram;
+  };
+
+  // Views a copy of bytes
+  FlatProgram(const std::string &bytes);
+
+  // Views memory, which it keeps alive
+  FlatProgram(MappedFile memory);
+  FlatProgram(std::shared_ptr<const void> storage, std::size_t size);
+
+  // Maps the file at path into memory
+  static std::unique_ptr<FlatProgram> map(const std::string &path);
+
+  std::string getName() const { return name; }
+  std::uint64_t getVecSize() const { return header->vecSize; }
+  std::size_t numTerms() const { return header->termCount; }
+  TermView getTerm(std::uint32_t index) const { return TermView(this, index); }
+
+  const std::unordered_map<std::string, std::uint32_t> &getInputs() const {
+    return inputs;
+  }
+  const std::unordered_map<std::string, std::uint32_t> &getOutputs() const {
+    return outputs;
+  }
+
+private:
+  std::shared_ptr<const void> storage;
+  const FlatHeader *header;
+  const FlatTerm *terms;
+  const std::uint32_t *operands;
+  const FlatAttribute *attributes;
+  const std::uint32_t *words;
+  const double *constants;
+
+  std::string name;
+  std::unordered_map<std::string, std::uint32_t> inputs;
+  std::unordered_map<std::string, std::uint32_t> outputs;
+
+  double getStoredValue(const FlatAttribute &attribute, std::size_t i) const;
+};
+
+} // namespace eva
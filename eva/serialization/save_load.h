@@ -3,6 +3,7 @@
 
 #pragma once
 
+#include "eva/serialization/constant_encoding.h"
 #include "eva/serialization/known_type.h"
 #include "eva/version.h"
 #include <fstream>
@@ -26,33 +27,40 @@ template <class T> T loadFromString(const std::string &str) {
   return std::get<T>(loadFromString(str));
 }
 
+// The saving functions pass any arguments after the object on to its serialize
+// function, such as the ConstantEncoding of a Program
 namespace detail {
-template <class T> void serializeKnownType(const T &obj, msg::KnownType &msg) {
-  auto inner = serialize(obj);
+template <class T, class... TArgs>
+void serializeKnownType(const T &obj, msg::KnownType &msg,
+                        const TArgs &... args) {
+  auto inner = serialize(obj, args...);
   msg.set_creator("EVA " + version());
   msg.mutable_contents()->PackFrom(*inner);
 }
 } // namespace detail
 
-template <class T> void save(const T &obj, std::ostream &out) {
+template <class T, class... TArgs>
+void save(const T &obj, std::ostream &out, const TArgs &... args) {
   msg::KnownType msg;
-  detail::serializeKnownType(obj, msg);
+  detail::serializeKnownType(obj, msg, args...);
   if (!msg.SerializeToOstream(&out)) {
     throw std::runtime_error("Could not serialize message");
   }
 }
 
-template <class T> void saveToFile(const T &obj, const std::string &path) {
+template <class T, class... TArgs>
+void saveToFile(const T &obj, const std::string &path, const TArgs &... args) {
   std::ofstream out(path);
   if (out.fail()) {
     throw std::runtime_error("Could not open file");
   }
-  save(obj, out);
+  save(obj, out, args...);
 }
 
-template <class T> std::string saveToString(const T &obj) {
+template <class T, class... TArgs>
+std::string saveToString(const T &obj, const TArgs &... args) {
   msg::KnownType msg;
-  detail::serializeKnownType(obj, msg);
+  detail::serializeKnownType(obj, msg, args...);
   std::string str;
   if (msg.SerializeToString(&str)) {
     return str;
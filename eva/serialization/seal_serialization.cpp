@@ -5,6 +5,7 @@
 #include "eva/util/overloaded.h"
 #include <memory>
 #include <string>
+#include <utility>
 #include <variant>
 
 using namespace std;
@@ -39,6 +40,20 @@ template <> auto getSEALTypeTag<seal::RelinKeys>() {
   return SEALObject::RELIN_KEYS;
 }
 
+// Seeded keys are saved in a form that loads as the keys themselves
+
+template <> auto getSEALTypeTag<seal::Serializable<seal::PublicKey>>() {
+  return SEALObject::PUBLIC_KEY;
+}
+
+template <> auto getSEALTypeTag<seal::Serializable<seal::GaloisKeys>>() {
+  return SEALObject::GALOIS_KEYS;
+}
+
+template <> auto getSEALTypeTag<seal::Serializable<seal::RelinKeys>>() {
+  return SEALObject::RELIN_KEYS;
+}
+
 template <> auto getSEALTypeTag<seal::EncryptionParameters>() {
   return SEALObject::ENCRYPTION_PARAMETERS;
 }
@@ -174,10 +189,28 @@ unique_ptr<msg::SEALPublic> serialize(const SEALPublic &obj) {
   serializeSEALType(obj.context.key_context_data()->parms(),
                     msg->mutable_encryption_parameters());
 
+  // Save the keys in seeded form if they were generated with seeds
+  if (obj.seededPublicKey) {
+    serializeSEALType(*obj.seededPublicKey, msg->mutable_public_key());
+    auto &galoisKeysMap = *msg->mutable_seeded_galois_keys();
+    for (auto &[step, keys] : obj.seededGaloisKeys) {
+      serializeSEALType(keys, &galoisKeysMap[step]);
+    }
+    if (obj.seededRelinKeys) {
+      serializeSEALType(*obj.seededRelinKeys, msg->mutable_relin_keys());
+    }
+    return msg;
+  }
+
   // Save the different public keys
   serializeSEALType(obj.publicKey, msg->mutable_public_key());
   serializeSEALType(obj.galoisKeys, msg->mutable_galois_keys());
-  serializeSEALType(obj.relinKeys, msg->mutable_relin_keys());
+
+  // Contexts restricted to programs without relinearizations, or generated
+  // for parameters without them, have no relinearization keys
+  if (obj.relinKeys.size() > 0) {
+    serializeSEALType(obj.relinKeys, msg->mutable_relin_keys());
+  }
 
   return msg;
 }
@@ -194,9 +227,18 @@ unique_ptr<SEALPublic> deserialize(const msg::SEALPublic &msg) {
   seal::PublicKey pk;
   deserializeSEALTypeWithContext(context, pk, msg.public_key());
   seal::GaloisKeys gk;
-  deserializeSEALTypeWithContext(context, gk, msg.galois_keys());
+  if (msg.has_galois_keys()) {
+    deserializeSEALTypeWithContext(context, gk, msg.galois_keys());
+  }
+  for (auto &[step, keysMsg] : msg.seeded_galois_keys()) {
+    seal::GaloisKeys part;
+    deserializeSEALTypeWithContext(context, part, keysMsg);
+    mergeGaloisKeys(gk, move(part));
+  }
   seal::RelinKeys rk;
-  deserializeSEALTypeWithContext(context, rk, msg.relin_keys());
+  if (msg.has_relin_keys()) {
+    deserializeSEALTypeWithContext(context, rk, msg.relin_keys());
+  }
 
   return make_unique<SEALPublic>(context, pk, gk, rk);
 }
@@ -0,0 +1,62 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "eva/util/mapped_file.h"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace eva {
+
+MappedFile mapFile(const string &path) {
+#ifdef _WIN32
+  ifstream in(path, ios::binary);
+  if (in.fail()) {
+    throw runtime_error("Could not open file");
+  }
+  return copyToAlignedMemory(
+      string(istreambuf_iterator<char>(in), istreambuf_iterator<char>()));
+#else
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw runtime_error("Could not open file");
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0) {
+    close(fd);
+    throw runtime_error("Could not open file");
+  }
+  size_t size = status.st_size;
+  if (size == 0) {
+    close(fd);
+    return copyToAlignedMemory("");
+  }
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    throw runtime_error("Could not map file");
+  }
+  shared_ptr<const void> mapping(
+      data, [size](const void *data) { munmap(const_cast<void *>(data), size); });
+  return {move(mapping), size};
+#endif
+}
+
+MappedFile copyToAlignedMemory(const string &bytes) {
+  shared_ptr<max_align_t[]> copy(
+      new max_align_t[bytes.size() / sizeof(max_align_t) + 1]);
+  memcpy(copy.get(), bytes.data(), bytes.size());
+  return {shared_ptr<const void>(copy, copy.get()), bytes.size()};
+}
+
+} // namespace eva
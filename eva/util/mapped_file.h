@@ -0,0 +1,25 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace eva {
+
+// Read-only memory holding the contents of a file, which stays valid for as
+// long as data is held. The memory is aligned for any fundamental type.
+struct MappedFile {
+  std::shared_ptr<const void> data;
+  std::size_t size;
+};
+
+// Maps the file at path into memory, or reads it where mapping is unsupported
+MappedFile mapFile(const std::string &path);
+
+// Copies bytes into memory aligned like a mapped file
+MappedFile copyToAlignedMemory(const std::string &bytes);
+
+} // namespace eva
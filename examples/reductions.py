@@ -0,0 +1,75 @@
+# Copyright (c) Microsoft Corporation. All rights reserved.
+# Licensed under the MIT license.
+
+# Benchmarks the reductions in eva.std.numeric against building the same
+# results from horizontal_sum, reporting rotation keys and execution time.
+
+from eva import EvaProgram, Input, Output, evaluate
+from eva.ckks import CKKSCompiler
+from eva.seal import generate_keys
+from eva.metric import valuation_mse
+from eva.std.numeric import horizontal_sum, segmented_sum, broadcast, dot_products
+from random import uniform
+import time
+
+vec_size = 4096
+segment = 512
+pairs = 16
+
+def naive_segmented_sum(x):
+    total = None
+    for first in range(0, vec_size, segment):
+        block = horizontal_sum(x * [1 if first <= j < first + segment else 0 for j in range(vec_size)])
+        block = block * [1 if j == first else 0 for j in range(vec_size)]
+        total = block if total is None else total + block
+    return total
+
+def naive_broadcast(x):
+    total = None
+    for first in range(0, vec_size, segment):
+        block = horizontal_sum(x * [1 if j == first + 5 else 0 for j in range(vec_size)])
+        block = block * [1 if first <= j < first + segment else 0 for j in range(vec_size)]
+        total = block if total is None else total + block
+    return total
+
+def naive_dot_products(inputs):
+    total = None
+    for j, (a, b) in enumerate(inputs):
+        dot = horizontal_sum(a * b) * [1 if k == j * (vec_size // pairs) else 0 for k in range(vec_size)]
+        total = dot if total is None else total + dot
+    return total
+
+def make_program(name, body, count):
+    prog = EvaProgram(name, vec_size=vec_size)
+    with prog:
+        xs = [Input(f'x{j}') for j in range(count)]
+        Output('y', body(xs))
+    prog.set_input_scales(40)
+    prog.set_output_ranges(20)
+    return prog
+
+benchmarks = [
+    ('segmented_sum', lambda xs: segmented_sum(xs[0], segment), lambda xs: naive_segmented_sum(xs[0]), 1),
+    ('broadcast', lambda xs: broadcast(xs[0], 5, segment), lambda xs: naive_broadcast(xs[0]), 1),
+    ('dot_products', lambda xs: dot_products(list(zip(xs[:pairs], xs[pairs:]))),
+        lambda xs: naive_dot_products(list(zip(xs[:pairs], xs[pairs:]))), 2 * pairs),
+]
+
+if __name__ == "__main__":
+    for name, primitive, naive, count in benchmarks:
+        for variant, body in [('primitive', primitive), ('naive', naive)]:
+            prog = make_program(f'{name}_{variant}', body, count)
+            inputs = { name: [uniform(-1, 1) for _ in range(vec_size)] for name in prog.inputs }
+
+            compiled, params, signature = CKKSCompiler(config={'warn_vec_size':'false'}).compile(prog)
+            public_ctx, secret_ctx = generate_keys(params)
+            enc_inputs = public_ctx.encrypt(inputs, signature)
+            start = time.perf_counter()
+            enc_outputs = public_ctx.execute(compiled, enc_inputs)
+            elapsed = time.perf_counter() - start
+            outputs = secret_ctx.decrypt(enc_outputs, signature)
+
+            reference = evaluate(prog, inputs)
+            print(f'{prog.name}: {len(params.rotations)} rotation keys, '
+                  f'{len(params.prime_bits)} primes, {elapsed:.3f} s, '
+                  f'MSE {valuation_mse(outputs, reference)}')
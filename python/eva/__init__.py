@@ -115,6 +115,16 @@ class Expr():
         """ Create a negation term """
         return Expr(self.program._make_term(Op.Negate, [self.term]), self.program)
 
+    def permute(self, sources):
+        """ Create a permutation term whose element i is element sources[i] of this one
+
+            Parameters
+            ----------
+            sources : list of int
+                The index of the source element for each element of the vector
+            """
+        return Expr(self.program._make_permutation(self.term, sources), self.program)
+
 class EvaProgram(Program):
     """ A wrapper for EVA's native Program class. Acts as a context manager to
         set the program the Input and Output free functions operate on. """
@@ -131,6 +141,14 @@ class EvaProgram(Program):
                 Must be a power-of-two
             """
         super().__init__(name, vec_size)
+        self._functions = {}
+
+    def _function_index(self, function):
+        """ Returns the index of function in this program, adding a copy of it on first use """
+        key = id(function)
+        if key not in self._functions:
+            self._functions[key] = (function, self._add_function(function))
+        return self._functions[key][1]
 
     def __enter__(self):
         global _current_program
@@ -169,3 +187,29 @@ def Output(name, expr):
         """
     program = _curr()
     program._make_output(name, _py_to_term(expr, program))
+
+def Call(function, arguments):
+    """ Create terms in the current EvaProgram that call another EvaProgram as a
+        function. The function is stored once in the current program however
+        many times it is called, so building, saving and evaluating the program
+        with evaluate take time and space in proportion to its distinct code.
+        Compiling expands a copy of the function at every call, so compile time
+        and memory still grow with the number of calls.
+
+        Parameters
+        ----------
+        function : EvaProgram
+            The function to call. It is copied on its first call from the
+            current program, so it must be complete by then.
+        arguments : dict from strings to Expr, lists or numbers
+            A value for each input of the function by name
+
+        Returns
+        -------
+        dict from strings to Expr
+            The value of each output of the function by name
+        """
+    program = _curr()
+    index = program._function_index(function)
+    terms = program._make_call(index, { name: _py_to_term(value, program) for name, value in arguments.items() })
+    return { name: Expr(term, program) for name, term in terms.items() }
@@ -0,0 +1,26 @@
+# Copyright (c) Microsoft Corporation. All rights reserved.
+# Licensed under the MIT license.
+
+""" Writes a copy of a saved public context with only the keys a compiled
+    program needs. Usage:
+
+        python -m eva.seal.restrict PUBLIC_CTX PROGRAM OUTPUT
+    """
+
+import argparse
+from eva import load, save
+
+def main():
+    parser = argparse.ArgumentParser(prog='python -m eva.seal.restrict',
+        description='Write a copy of a public context with only the keys a compiled program needs.')
+    parser.add_argument('public_ctx', help='the saved SEALPublic to restrict')
+    parser.add_argument('program', help='the saved compiled program')
+    parser.add_argument('output', help='the path to save the restricted SEALPublic to')
+    args = parser.parse_args()
+
+    public_ctx = load(args.public_ctx)
+    program = load(args.program)
+    save(public_ctx.restrict_to(program), args.output)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,126 @@
+# Copyright (c) Microsoft Corporation. All rights reserved.
+# Licensed under the MIT license.
+from eva import py_to_eva
+
+# Ways of reaching the offset of kernel element (i, j) with a rotation of the
+# channels (baby step) followed by a rotation of the sums for each filter
+# (giant step)
+_SPLITS = [
+	lambda i, j, width: (i * width + j, 0),
+	lambda i, j, width: (0, i * width + j),
+	lambda i, j, width: (j, i * width),
+	lambda i, j, width: (i * width, j),
+]
+
+def _steps(channels, filters, width, split):
+	""" The baby steps for each channel and giant steps for each filter that a
+		split uses, skipping zero weights """
+
+	baby = set()
+	giant = set()
+	for f, kernels in enumerate(filters):
+		for c, kernel in enumerate(kernels):
+			for i, row in enumerate(kernel):
+				for j, weight in enumerate(row):
+					if weight != 0:
+						b, g = split(i, j, width)
+						baby.add((c, b))
+						giant.add((f, g))
+	return baby, giant
+
+def _cost(baby, giant):
+	""" The number of rotations and rotation keys for a set of steps """
+
+	rotations = sum(1 for _, b in baby if b != 0) + sum(1 for _, g in giant if g != 0)
+	keys = len(set(b for _, b in baby if b != 0) | set(g for _, g in giant if g != 0))
+	return rotations, keys
+
+def convolve2d(channels, width, filters, stride=1):
+	""" Convolve images in row-major layout with a set of filters. Element
+		y*width + x of the result for filter f is the sum over channels c and
+		kernel elements (i, j) of filters[f][c][i][j] times element
+		(y + i)*width + x + j of channel c.
+
+		Each kernel element is reached by a rotation of a channel followed by a
+		rotation of the weighted sum for a filter. How offsets are split between
+		the two is chosen to minimize the number of rotations, and then the
+		number of rotation keys. Rotations of channels are shared by all
+		filters, and rotations of sums are shared by all channels. For example,
+		a 3x3 kernel on one channel takes 4 rotations and 4 keys instead of 8.
+
+		With a stride larger than one, only elements at rows and columns that
+		are multiples of the stride and whose kernel window fits in the image
+		are computed. Other elements of the results are zero, as the weights
+		are fused into masks selecting the computed elements. With a stride of
+		one no masks are used and elements whose window crosses the right or
+		bottom edge of the image hold wrapped around values.
+
+		Parameters
+		----------
+		channels : an EVA compatible type or a list of them (see eva.py_to_eva)
+			The channels of the image, each a vector with rows of width elements
+		width : int
+			The number of elements in each row of the image
+		filters : list of lists of 2-D lists of numbers
+			The kernel for each filter and channel, indexed as
+			filters[filter][channel][row][column]
+		stride : int, optional
+			The distance between computed elements in both dimensions
+			(default: 1)
+
+		Returns
+		-------
+		A list with the convolution for each filter
+		"""
+
+	if not isinstance(channels, list):
+		channels = [channels]
+	channels = [py_to_eva(channel) for channel in channels]
+	program = channels[0].program
+	vec_size = program.vec_size
+	for kernels in filters:
+		if len(kernels) != len(channels):
+			raise ValueError("Each filter must have a kernel for each channel")
+
+	best = min(_SPLITS, key=lambda split: _cost(*_steps(channels, filters, width, split)))
+
+	mask = None
+	if stride > 1:
+		height = vec_size // width
+		kernel_height = max(len(kernel) for kernels in filters for kernel in kernels)
+		kernel_width = max(len(row) for kernels in filters for kernel in kernels for row in kernel)
+		mask = [0] * vec_size
+		for y in range(0, height - kernel_height + 1, stride):
+			for x in range(0, width - kernel_width + 1, stride):
+				mask[y * width + x] = 1
+
+	def weight(value, giant):
+		# The mask is rotated right by the giant step, so that it selects the
+		# computed elements after the sum is rotated left by it
+		if mask is None:
+			return value
+		return [value * mask[(k - giant) % vec_size] for k in range(vec_size)]
+
+	rotated = {}
+	def rotate(c, baby):
+		if (c, baby) not in rotated:
+			rotated[(c, baby)] = channels[c] << baby if baby != 0 else channels[c]
+		return rotated[(c, baby)]
+
+	results = []
+	for kernels in filters:
+		sums = {}
+		for c, kernel in enumerate(kernels):
+			for i, row in enumerate(kernel):
+				for j, value in enumerate(row):
+					if value == 0:
+						continue
+					baby, giant = best(i, j, width)
+					term = rotate(c, baby) * weight(value, giant)
+					sums[giant] = sums[giant] + term if giant in sums else term
+		result = None
+		for giant in sorted(sums):
+			value = sums[giant] << giant if giant != 0 else sums[giant]
+			result = value if result is None else result + value
+		results.append(result if result is not None else channels[0] * 0)
+	return results
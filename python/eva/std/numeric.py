@@ -19,3 +19,126 @@ def horizontal_sum(x):
 		x = x + y
 		i <<= 1
 	return x
+
+def segmented_sum(x, size, replicate=False):
+	""" Sum together the elements in each segment of size consecutive
+		elements of a vector. The sum of a segment is in its first element, or
+		replicated in all of its elements if replicate is set. Other elements
+		hold partial sums. Takes log2(size) rotations, and another log2(size)
+		rotations and a level for masking if replicate is set.
+
+		Parameters
+		----------
+		x : an EVA compatible type (see eva.py_to_eva)
+			The vector to sum segments of
+		size : int
+			The number of elements in each segment. Must be a power-of-two
+			that divides the vector size
+		replicate : bool, optional
+			Whether to replicate the sums in their segments (default: False)
+		"""
+
+	x = py_to_eva(x)
+	vec_size = x.program.vec_size
+	if size <= 0 or size & (size - 1) != 0 or vec_size % size != 0:
+		raise ValueError("Segment size must be a power-of-two that divides the vector size")
+	i = 1
+	while i < size:
+		x = x + (x << i)
+		i <<= 1
+	if replicate and size > 1:
+		x = x * [1 if j % size == 0 else 0 for j in range(vec_size)]
+		i = 1
+		while i < size:
+			x = x + (x >> i)
+			i <<= 1
+	return x
+
+def broadcast(x, slot, size=None):
+	""" Replicate one element of each segment of size consecutive elements of
+		a vector to the whole segment. Takes a level for masking, log2(size)
+		rotations and one more to align the element if size is less than the
+		vector size and slot is not zero.
+
+		Parameters
+		----------
+		x : an EVA compatible type (see eva.py_to_eva)
+			The vector to broadcast elements of
+		slot : int
+			The index of the element within each segment
+		size : int, optional
+			The number of elements in each segment. Must be a power-of-two
+			that divides the vector size (default: the vector size)
+		"""
+
+	x = py_to_eva(x)
+	vec_size = x.program.vec_size
+	if size == None:
+		size = vec_size
+	if size <= 0 or size & (size - 1) != 0 or vec_size % size != 0:
+		raise ValueError("Segment size must be a power-of-two that divides the vector size")
+	if not 0 <= slot < size:
+		raise ValueError("Slot must be within the segment")
+	x = x * [1 if j % size == slot else 0 for j in range(vec_size)]
+	if size == vec_size:
+		# Summing the whole vector replicates the only nonzero element
+		return horizontal_sum(x)
+	if slot != 0:
+		x = x << slot
+	i = 1
+	while i < size:
+		x = x + (x >> i)
+		i <<= 1
+	return x
+
+def dot_products(pairs):
+	""" Compute the dot products of many pairs of vectors together. The products
+		of pairs are combined into a single vector while they are reduced, so
+		that k pairs take 2k - 2 + log2(vecSize / k) rotations instead of the
+		k * log2(vecSize) of summing each product separately. Combining takes a
+		level for masking for each halving of the number of vectors.
+
+		The dot product of pair j is in element j * vecSize / k of the returned
+		vector, where k is the number of pairs rounded up to a power-of-two.
+		Other elements hold partial sums.
+
+		Parameters
+		----------
+		pairs : list of pairs of EVA compatible types (see eva.py_to_eva)
+			The pairs of vectors to compute dot products of
+		"""
+
+	vectors = [py_to_eva(a) * b for a, b in pairs]
+	vec_size = vectors[0].program.vec_size
+	k = 1
+	while k < len(vectors):
+		k <<= 1
+	if k > vec_size:
+		raise ValueError("Number of pairs must be at most the vector size")
+	vectors += [None] * (k - len(vectors))
+
+	# Each step halves the number of vectors by reducing the first of each pair
+	# of vectors into the low halves of blocks of 2*shift elements and the
+	# second into the high halves
+	shift = vec_size
+	while len(vectors) > 1:
+		shift >>= 1
+		low_mask = [1 if (j // shift) % 2 == 0 else 0 for j in range(vec_size)]
+		high_mask = [1 - m for m in low_mask]
+		half = len(vectors) // 2
+		merged = []
+		for low, high in zip(vectors[:half], vectors[half:]):
+			terms = []
+			if low is not None:
+				terms.append((low + (low << shift)) * low_mask)
+			if high is not None:
+				terms.append((high + (high >> shift)) * high_mask)
+			merged.append(sum(terms[1:], terms[0]) if terms else None)
+		vectors = merged
+
+	# Finish reducing each block into its first element
+	result = vectors[0]
+	while shift > 1:
+		shift >>= 1
+		result = result + (result << shift)
+	return result
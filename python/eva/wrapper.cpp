@@ -5,6 +5,7 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include "eva/eva.h"
+#include "eva/seal/seal_executor.h"
 #ifdef EVA_USE_GALOIS
 #include <galois/Galois.h>
 #include "eva/util/galois.h"
@@ -22,6 +23,15 @@ path : str
     Path of the file to save to
 )DELIMITER";
 
+void setInputScales(const Program& prog, uint32_t scale) {
+  for (auto& source : prog.getSources()) {
+    source->set<EncodeAtScaleAttribute>(scale);
+  }
+  for (auto& function : prog.getFunctions()) {
+    setInputScales(*function, scale);
+  }
+}
+
 // clang-format off
 PYBIND11_MODULE(_eva, m) {
   m.doc() = "Python wrapper for EVA";
@@ -62,13 +72,55 @@ Parameters
 ----------
 range : int
     The range in bits. Must be positive.)DELIMITER", py::arg("range"))
-    .def("set_input_scales", [](const Program& prog, uint32_t scale) {
-      for (auto& source : prog.getSources()) {
-        source->set<EncodeAtScaleAttribute>(scale);
+    .def("set_output_range", [](const Program& prog, const string& name, uint32_t range) {
+      auto& outputs = prog.getOutputs();
+      auto output = outputs.find(name);
+      if (output == outputs.end()) {
+        throw std::runtime_error("No output named " + name);
+      }
+      output->second->set<RangeAttribute>(range);
+    }, R"DELIMITER(Affects the range of a single output. See set_output_ranges.
+
+Parameters
+----------
+name : str
+    The name of the output
+range : int
+    The range in bits. Must be positive.)DELIMITER", py::arg("name"), py::arg("range"))
+    .def("set_input_ranges", [](const Program& prog, uint32_t range) {
+      for (auto& entry : prog.getInputs()) {
+        entry.second->set<RangeAttribute>(range);
       }
-    }, R"DELIMITER(Sets the scales that inputs will be encoded at. Sets the scales for all
-inputs at once. This value will also be interpreted as the minimum scale
-that any intermediate value have.
+    }, R"DELIMITER(Bounds the values of inputs. Sets all inputs at once.
+
+An input with range r is promised to only hold values in [-2^r, 2^r]. The
+compiler uses input ranges to infer bounds for the outputs, and will lower
+output ranges to the inferred ones when they are tighter. Inputs without a
+range are considered unbounded.
+
+Parameters
+----------
+range : int
+    The range in bits)DELIMITER", py::arg("range"))
+    .def("set_input_range", [](const Program& prog, const string& name, uint32_t range) {
+      auto& inputs = prog.getInputs();
+      auto input = inputs.find(name);
+      if (input == inputs.end()) {
+        throw std::runtime_error("No input named " + name);
+      }
+      input->second->set<RangeAttribute>(range);
+    }, R"DELIMITER(Bounds the values of a single input. See set_input_ranges.
+
+Parameters
+----------
+name : str
+    The name of the input
+range : int
+    The range in bits)DELIMITER", py::arg("name"), py::arg("range"))
+    .def("set_input_scales", &setInputScales, R"DELIMITER(Sets the scales that inputs will be encoded at. Sets the scales for all
+inputs at once, including those of the functions this program calls. This
+value will also be interpreted as the minimum scale that any intermediate
+value have.
 
 Parameters
 ----------
@@ -83,10 +135,13 @@ str
     .def("_make_term", &Program::makeTerm, py::keep_alive<0,1>())
     .def("_make_left_rotation", &Program::makeLeftRotation, py::keep_alive<0,1>())
     .def("_make_right_rotation", &Program::makeRightRotation, py::keep_alive<0,1>())
+    .def("_make_permutation", &Program::makePermutation, py::keep_alive<0,1>())
     .def("_make_dense_constant", &Program::makeDenseConstant, py::keep_alive<0,1>())
     .def("_make_uniform_constant", &Program::makeUniformConstant, py::keep_alive<0,1>())
     .def("_make_input", &Program::makeInput, py::keep_alive<0,1>())
-    .def("_make_output", &Program::makeOutput, py::keep_alive<0,1>());
+    .def("_make_output", &Program::makeOutput, py::keep_alive<0,1>())
+    .def("_add_function", &Program::addFunction)
+    .def("_make_call", &Program::makeCall, py::keep_alive<0,1>());
 
   m.def("evaluate", &evaluate, R"DELIMITER(Evaluate the program without homomorphic encryption
 
@@ -105,9 +160,53 @@ Returns
 -------
 dict from strings to lists of numbers
     The outputs from the evaluation)DELIMITER", py::arg("program"), py::arg("inputs"));
-  
+  m.def("specialize", &specialize, R"DELIMITER(Bind unencrypted inputs of a program to known values
+
+Returns a copy of the program where the given inputs have been replaced by
+constants. When the copy is compiled, computation on these values is folded
+into constants and the values no longer need to be passed when executing.
+This is useful for inputs that are fixed for many executions, such as model
+weights. Encrypted inputs can not be bound.
+
+Parameters
+----------
+program : Program
+    The program to specialize. It is not modified.
+inputs : dict from strings to lists of numbers
+    Values for a subset of the unencrypted inputs of the program
+
+Returns
+-------
+Program
+    The specialized program)DELIMITER", py::arg("program"), py::arg("inputs"));
+
   // Serialization
+  py::enum_<ConstantQuantization>(m, "ConstantQuantization")
+    .value("Double", ConstantQuantization::Double)
+    .value("Float32", ConstantQuantization::Float32)
+    .value("FixedPoint", ConstantQuantization::FixedPoint);
+  py::class_<ConstantEncoding>(m, "ConstantEncoding", "Encodings for the constants of saved programs, all off by default")
+    .def(py::init<>())
+    .def_readwrite("deduplicate", &ConstantEncoding::deduplicate, "Store equal constants once for all terms holding them")
+    .def_readwrite("run_length", &ConstantEncoding::runLength, "Store runs of equal values, as found in masks, as a value and a length")
+    .def_readwrite("quantization", &ConstantEncoding::quantization, R"DELIMITER(Store the values of constants that are only encoded into plaintexts with fewer bits
+
+Constants may be negated or rotated on the way to being encoded. No value changes
+by more than max_error, and nothing is quantized while it is zero; constants that
+need more bits are stored exactly. A warning is given for constants for which
+max_error is coarser than the rounding of encoding them at their scale.)DELIMITER")
+    .def_readwrite("max_error", &ConstantEncoding::maxError, "The largest change quantization may make to a value; zero disables quantization")
+    .def_readwrite("compress", &ConstantEncoding::compress, "Compress the whole program with zlib; not available for the flat format");
   m.def("save", &saveToFile<Program>, SAVE_DOC_STRING, py::arg("obj"), py::arg("path"));
+  m.def("save", &saveToFile<Program, ConstantEncoding>, R"DELIMITER(Serialize and save a program to a file with its constants encoded.
+
+Parameters
+----------
+path : str
+    Path of the file to save to
+constants : ConstantEncoding
+    The encodings to store the constants of the program in
+)DELIMITER", py::arg("obj"), py::arg("path"), py::arg("constants"));
   m.def("save", &saveToFile<CKKSParameters>, SAVE_DOC_STRING, py::arg("obj"), py::arg("path"));
   m.def("save", &saveToFile<CKKSSignature>, SAVE_DOC_STRING, py::arg("obj"), py::arg("path"));
   m.def("save", &saveToFile<SEALValuation>, SAVE_DOC_STRING, py::arg("obj"), py::arg("path"));
@@ -123,6 +222,39 @@ path : str
 Returns
 -------
 An object of the same class as was previously serialized)DELIMITER", py::arg("path"));
+  m.def("save_flat", [](Program& program, const string& path, const ConstantEncoding& constants) {
+    ofstream out(path, ios::binary);
+    if (out.fail()) {
+      throw runtime_error("Could not open file");
+    }
+    out << flatten(program, constants);
+  }, R"DELIMITER(Save a compiled program in the flat format
+
+A program in the flat format is memory mapped when loaded with load_flat and
+executed without building its terms, which makes loading large programs fast.
+
+Parameters
+----------
+program : Program
+    The compiled program to save
+path : str
+    Path of the file to save to
+constants : ConstantEncoding, optional
+    The encodings to store the constants of the program in, except compression)DELIMITER", py::arg("program"), py::arg("path"), py::arg("constants") = ConstantEncoding());
+  m.def("load_flat", &FlatProgram::map, R"DELIMITER(Map a program saved in the flat format into memory
+
+Parameters
+----------
+path : str
+    Path of the file to load from
+
+Returns
+-------
+FlatProgram
+    The program, which can be executed with SEALPublic.execute)DELIMITER", py::arg("path"));
+  py::class_<FlatProgram>(m, "FlatProgram", "A compiled program in the flat format")
+    .def_property_readonly("name", &FlatProgram::getName, "The name of this program")
+    .def_property_readonly("vec_size", &FlatProgram::getVecSize, "The number of elements for all vectors in this program");
 
   // Multi-core
   m.def("set_num_threads", [](int num_threads) {
@@ -152,7 +284,7 @@ Parameters
 ----------
 config : dict from strings to strings
     The configuration options to override)DELIMITER", py::arg("config"))
-    .def("compile", &CKKSCompiler::compile, R"DELIMITER(Compile a program for CKKS
+    .def("compile", py::overload_cast<Program&>(&CKKSCompiler::compile), R"DELIMITER(Compile a program for CKKS
 
 Parameters
 ----------
@@ -166,27 +298,78 @@ Program
 CKKSParameters
     The selected encryption parameters
 CKKSSignature
-    The signature of the program)DELIMITER", py::arg("program"));
+    The signature of the program)DELIMITER", py::arg("program"))
+    .def("compile", py::overload_cast<Program&, const CKKSParameters&>(&CKKSCompiler::compile), R"DELIMITER(Compile a program for CKKS to run with existing encryption parameters
+
+The keys generated for the parameters, for example those of another program,
+can then be used with this program too. Raises an error if the parameters
+lack rotation keys, slots or primes the program needs.
+
+Parameters
+----------
+program : Program
+    The program to compile
+params : CKKSParameters
+    The encryption parameters to run with
+
+Returns
+-------
+Program
+    The compiled program
+CKKSSignature
+    The signature of the program)DELIMITER", py::arg("program"), py::arg("params"))
+    .def("compile_family", &CKKSCompiler::compileFamily, R"DELIMITER(Compile programs for CKKS to run with a single set of encryption parameters
+
+One set of keys then serves all of the programs, and ciphertexts encrypted at
+the same scale and level can be passed to any of them.
+
+Parameters
+----------
+programs : list of Program
+    The programs to compile
+
+Returns
+-------
+list of Program
+    The compiled programs
+CKKSParameters
+    The encryption parameters shared by the programs
+list of CKKSSignature
+    The signatures of the programs)DELIMITER", py::arg("programs"));
   py::class_<CKKSParameters>(mckks, "CKKSParameters", "Abstract encryption parameters for CKKS")
     .def_readonly("prime_bits", &CKKSParameters::primeBits, "List of number of bits each prime should have")
     .def_readonly("rotations", &CKKSParameters::rotations, "List of steps that rotation keys should be generated for")
-    .def_readonly("poly_modulus_degree", &CKKSParameters::polyModulusDegree, "The polynomial degree N required");
+    .def_readonly("poly_modulus_degree", &CKKSParameters::polyModulusDegree, "The polynomial degree N required")
+    .def_readonly("needs_relin_keys", &CKKSParameters::needsRelinKeys, "Whether relinearization keys should be generated");
   py::class_<CKKSSignature>(mckks, "CKKSSignature", "The signature of a compiled program used for encoding and decoding")
     .def_readonly("vec_size", &CKKSSignature::vecSize, "The vector size of the program")
-    .def_readonly("inputs", &CKKSSignature::inputs, "Dictionary of CKKSEncodingInfo objects for each input");
+    .def_readonly("inputs", &CKKSSignature::inputs, "Dictionary of CKKSEncodingInfo objects for each input")
+    .def_readonly("packed_inputs", &CKKSSignature::packedInputs, "Dictionary of CKKSPackingInfo objects for each input packed into another")
+    .def_readonly("packed_outputs", &CKKSSignature::packedOutputs, "Dictionary of CKKSPackingInfo objects for each output packed into another")
+    .def_readonly("lanes", &CKKSSignature::lanes, "The number of instances batched into each ciphertext")
+    .def_readonly("tiles", &CKKSSignature::tiles, "The number of ciphertexts each input and output is split into")
+    .def_readonly("stride", &CKKSSignature::stride, "The number of slots between consecutive elements of inputs and outputs");
   py::class_<CKKSEncodingInfo>(mckks, "CKKSEncodingInfo", "Holds the information required for encoding an input")
     .def_readonly("input_type", &CKKSEncodingInfo::inputType, "The type of this input. Decides whether input is encoded, also encrypted or neither.")
     .def_readonly("scale", &CKKSEncodingInfo::scale, "The scale encoding should happen at")
     .def_readonly("level", &CKKSEncodingInfo::level, "The level encoding should happen at");
+  py::class_<CKKSPackingInfo>(mckks, "CKKSPackingInfo", "Holds the placement of an input or output packed into another")
+    .def_readonly("packed_name", &CKKSPackingInfo::packedName, "The name of the input or output this one is packed into")
+    .def_readonly("offset", &CKKSPackingInfo::offset, "The first slot of this one in the packed input or output")
+    .def_readonly("packed_size", &CKKSPackingInfo::packedSize, "The vector size of the packed input or output");
 
   // SEAL backend
   py::module mseal = m.def_submodule("_seal", "Python wrapper for EVA SEAL backend");
   mseal.def("generate_keys", &generateKeys, R"DELIMITER(Generate keys required for evaluation with SEAL
 
+Relinearization keys are only generated if the compiled programs need them.
+
 Parameters
 ----------
 abstract_params : CKKSParameters
     Specification of the encryption parameters from the compiler
+seeded : bool
+    Whether to save the public context with seeded keys, which halves its size
 
 Returns
 -------
@@ -196,8 +379,34 @@ SEALSecret
     The secret part of the SEAL context that is used for decryption.
     WARNING: This object holds your generated secret key. Do not share this object
               (or its serialized form) with anyone you do not want having access
-              to the values encrypted with the public context.)DELIMITER", py::arg("absract_params"));
+              to the values encrypted with the public context.)DELIMITER", py::arg("absract_params"), py::arg("seeded") = false);
+  mseal.def("prewarm_context", [](const CKKSParameters &params) {
+    SEALContextRegistry::global().prewarm(params);
+  }, py::arg("params"), R"DELIMITER(Create the SEAL context for encryption parameters ahead of its use
+
+Creating a context precomputes tables for every prime, so a server can do
+this when starting rather than when the first request arrives.
+
+Parameters
+----------
+params : CKKSParameters
+    The encryption parameters to create the context for)DELIMITER");
+  mseal.def("set_context_capacity", [](size_t capacity) {
+    SEALContextRegistry::global().setCapacity(capacity);
+  }, py::arg("capacity"), R"DELIMITER(Set how many SEAL contexts are kept for reuse
+
+The least recently used contexts are dropped beyond this. Contexts that are in
+use stay valid. The default is 16.
+
+Parameters
+----------
+capacity : int
+    The number of contexts to keep)DELIMITER");
+  mseal.def("get_context_capacity", []() {
+    return SEALContextRegistry::global().getCapacity();
+  }, "Get how many SEAL contexts are kept for reuse");
   py::class_<SEALValuation>(mseal, "SEALValuation", "A valuation for inputs or outputs holding values encrypted with SEAL");
+  py::class_<SEALFixedValues, shared_ptr<SEALFixedValues>>(mseal, "SEALFixedValues", "Values computed ahead of executing a program many times");
   py::class_<SEALPublic>(mseal, "SEALPublic", "The public part of the SEAL context that is used for encryption and execution.")
     .def("encrypt", &SEALPublic::encrypt, R"DELIMITER(Encrypt inputs for a compiled EVA program
 
@@ -212,7 +421,7 @@ Returns
 -------
 SEALValuation
     The encrypted inputs)DELIMITER", py::arg("inputs"), py::arg("signature"))
-    .def("execute", &SEALPublic::execute, R"DELIMITER(Execute a compiled EVA program with SEAL
+    .def("execute", py::overload_cast<Program&, const SEALValuation&>(&SEALPublic::execute), R"DELIMITER(Execute a compiled EVA program with SEAL
 
 Parameters
 ----------
@@ -224,7 +433,139 @@ inputs : SEALValuation
 Returns
 -------
 SEALValuation
-    The encrypted outputs)DELIMITER", py::arg("program"), py::arg("inputs"));
+    The encrypted outputs)DELIMITER", py::arg("program"), py::arg("inputs"))
+    .def("prepare", [](SEALPublic& self, Program& program, const SEALValuation& bound) {
+      return const_pointer_cast<SEALFixedValues>(self.prepare(program, bound));
+    }, R"DELIMITER(Compute the terms of a compiled EVA program that only depend on bound inputs
+
+Inputs such as weights that stay the same across executions are bound once,
+and the terms computed from them are reused by every execution given the
+result. The program must not be changed afterwards.
+
+Parameters
+----------
+program : Program
+    The program to be executed
+bound : SEALValuation
+    The encoded or encrypted values of the inputs to bind
+
+Returns
+-------
+SEALFixedValues
+    The values to pass to execute)DELIMITER", py::arg("program"), py::arg("bound"))
+    .def("execute", py::overload_cast<Program&, const SEALValuation&, const SEALFixedValues&>(&SEALPublic::execute), R"DELIMITER(Execute a compiled EVA program with SEAL and values computed by prepare
+
+Parameters
+----------
+program : Program
+    The program to be executed
+inputs : SEALValuation
+    The encrypted valuation for the inputs of the program that were not bound
+fixed : SEALFixedValues
+    The values prepare computed for the program
+
+Returns
+-------
+SEALValuation
+    The encrypted outputs)DELIMITER", py::arg("program"), py::arg("inputs"), py::arg("fixed"))
+    .def("execute", py::overload_cast<const FlatProgram&, const SEALValuation&>(&SEALPublic::execute), R"DELIMITER(Execute a compiled EVA program in the flat format with SEAL
+
+Terms are computed one at a time, even with multi-core support.
+
+Parameters
+----------
+program : FlatProgram
+    The program to be executed
+inputs : SEALValuation
+    The encrypted valuation for the inputs of the program
+
+Returns
+-------
+SEALValuation
+    The encrypted outputs)DELIMITER", py::arg("program"), py::arg("inputs"))
+    .def("restrict_to", &SEALPublic::restrictTo, R"DELIMITER(Copy this context with only the keys a compiled EVA program needs
+
+When one set of keys serves many programs, a worker executing a single
+program can load the smaller copy instead. The same copy can also be made
+with "python -m eva.seal.restrict".
+
+Parameters
+----------
+program : Program
+    The compiled program, which must have been compiled for the parameters
+    of this context
+
+Returns
+-------
+SEALPublic
+    A public context with the rotation keys and relinearization keys the
+    program needs)DELIMITER", py::arg("program"));
+  mseal.def("save_bundle", [](Program& program, const CKKSParameters& params, const CKKSSignature& signature, const SEALPublic& publicCtx, const string& path, const ConstantEncoding& constants) {
+    ofstream out(path, ios::binary);
+    if (out.fail()) {
+      throw runtime_error("Could not open file");
+    }
+    out << bundle(program, params, signature, publicCtx, constants);
+  }, R"DELIMITER(Save a compiled program with everything needed to execute it in one file
+
+The bundle holds the program in the flat format, its parameters and signature,
+and the public context with only the keys the program needs.
+
+Parameters
+----------
+program : Program
+    The compiled program
+params : CKKSParameters
+    The parameters the program was compiled for
+signature : CKKSSignature
+    The signature of the program
+public_ctx : SEALPublic
+    A public context for the parameters
+path : str
+    Path of the file to save to
+constants : ConstantEncoding, optional
+    The encodings to store the constants of the program in, except compression)DELIMITER",
+    py::arg("program"), py::arg("params"), py::arg("signature"), py::arg("public_ctx"), py::arg("path"), py::arg("constants") = ConstantEncoding());
+  mseal.def("load_bundle", &SEALBundle::map, R"DELIMITER(Map a bundle saved with save_bundle into memory and prepare it for execution
+
+Loading creates the SEAL context and computes everything that does not depend
+on the inputs, such as the plaintexts of constants.
+
+Parameters
+----------
+path : str
+    Path of the file to load from
+
+Returns
+-------
+SEALBundle
+    The bundle, ready to execute its program)DELIMITER", py::arg("path"));
+  py::class_<SEALBundle>(mseal, "SEALBundle", "A compiled program loaded from a bundle with everything needed to execute it")
+    .def_property_readonly("program", &SEALBundle::getProgram, py::return_value_policy::reference_internal, "The program in the flat format")
+    .def_property_readonly("params", &SEALBundle::getParameters, py::return_value_policy::reference_internal, "The parameters the program was compiled for")
+    .def_property_readonly("signature", &SEALBundle::getSignature, py::return_value_policy::reference_internal, "The signature of the program")
+    .def_property_readonly("public_ctx", &SEALBundle::getPublic, py::return_value_policy::reference_internal, "The public context for encrypting inputs")
+    .def("bind", &SEALBundle::bind, R"DELIMITER(Bind inputs that stay the same across executions
+
+Everything computed from the bound inputs and constants only is computed once
+here, and later executions take only the other inputs. Binding again replaces
+the inputs bound before.
+
+Parameters
+----------
+bound : SEALValuation
+    The encoded or encrypted values of the inputs to bind)DELIMITER", py::arg("bound"))
+    .def("execute", py::overload_cast<const SEALValuation&>(&SEALBundle::execute, py::const_), R"DELIMITER(Execute the program of this bundle with SEAL
+
+Parameters
+----------
+inputs : SEALValuation
+    The encrypted valuation for the inputs of the program
+
+Returns
+-------
+SEALValuation
+    The encrypted outputs)DELIMITER", py::arg("inputs"));
   py::class_<SEALSecret>(mseal, "SEALSecret", R"DELIMITER(The secret part of the SEAL context that is used for decryption.
 
 WARNING: This object holds your generated secret key. Do not share this object
@@ -4,8 +4,12 @@
 import unittest
 import tempfile
 import os
+import re
+import struct
+from random import Random
 from common import *
-from eva import EvaProgram, Input, Output, save, load
+from eva import EvaProgram, Input, Output, Call, save, load, save_flat, load_flat, specialize, ConstantEncoding, ConstantQuantization
+from eva.seal import prewarm_context, set_context_capacity, get_context_capacity, save_bundle, load_bundle
 
 class Features(EvaTestCase):
     def test_bin_ops(self):
@@ -132,6 +136,697 @@ class Features(EvaTestCase):
             config={'rescaler':'always', 'balance_reductions':'true', 'warn_vec_size':'false'})
         self.assertEqual(params.prime_bits, [60, 20, 60, 60, 60])
 
+    def test_reduction_balancer_depth(self):
+        """ Check that balanced reductions combine shallow operands first """
+
+        prog = EvaProgram('UnbalancedReduction', vec_size=1024)
+        with prog:
+            a = Input('a')
+            b = Input('b')
+            c = Input('c')
+            x = Input('x')
+            Output('y', a*(b*(c*((x*x)*(x*x) + 1))))
+
+        prog.set_output_ranges(20)
+        prog.set_input_scales(30)
+
+        progc, params, signature = self.assert_compiles_and_matches_reference(prog,
+            config={'rescaler':'always', 'balance_reductions':'true', 'warn_vec_size':'false'})
+        self.assertEqual(params.prime_bits, [50, 30, 30, 30, 50])
+
+    def test_tree_height_reduction(self):
+        """ Check that distributing multiplications reduces depth under reduce_tree_height=true """
+
+        prog = EvaProgram('Horner', vec_size=1024)
+        with prog:
+            a, b, c, d, e, f, g = [Input(name) for name in 'abcdefg']
+            Output('y', ((a*b + c)*d - e)*f + g)
+
+        prog.set_output_ranges(20)
+        prog.set_input_scales(40)
+
+        progc, params, signature = self.assert_compiles_and_matches_reference(prog,
+            config={'rescaler':'always', 'reduce_tree_height':'false', 'warn_vec_size':'false'})
+        self.assertEqual(params.prime_bits, [60, 40, 40, 40, 60])
+
+        progc, params, signature = self.assert_compiles_and_matches_reference(prog,
+            config={'rescaler':'always', 'reduce_tree_height':'true', 'warn_vec_size':'false'})
+        self.assertEqual(params.prime_bits, [60, 40, 40, 60])
+
+    def test_key_switch_sinking(self):
+        """ Check that sink_key_switches=true moves key switches below rescales and keeps results unchanged """
+
+        for sink in ['false', 'true']:
+            for relin in ['false', 'true']:
+                prog = EvaProgram('KeySwitchSinking', vec_size=1024)
+                with prog:
+                    x = Input('x')
+                    y = (x << 3) * [1, 2, 3, 4] + 2
+                    z = (x >> 5) * (x >> 5)
+                    Output('y', (y * z) << 7)
+
+                prog.set_output_ranges(20)
+                prog.set_input_scales(30)
+
+                compiled, params, signature = self.assert_compiles_and_matches_reference(prog,
+                    config={'sink_key_switches':sink, 'lazy_relinearize':relin, 'warn_vec_size':'false'})
+
+                # Count the rotations and relinearizations computed on the result of a rescale or mod switch
+                dot = compiled.to_DOT()
+                labels = dict(re.findall(r'^(t\d+) \[label="([^"]+)"\]', dot, re.M))
+                edges = re.findall(r'^(t\d+) -> (t\d+) \[label="\d+"\]', dot, re.M)
+                sunk = [use for operand, use in edges
+                    if labels.get(use, '').startswith(('Rotate', 'Relinearize'))
+                    and labels.get(operand, '').startswith(('Rescale', 'ModSwitch'))]
+                if sink == 'true':
+                    self.assertGreater(len(sunk), 0)
+                else:
+                    self.assertEqual(len(sunk), 0)
+
+    def test_permute(self):
+        """ Check that permutations lowered to rotations and masks keep results unchanged """
+
+        sources = list(range(64))
+        Random(5).shuffle(sources)
+        for budget in ['0', '6']:
+            prog = EvaProgram('Permute', vec_size=64)
+            with prog:
+                x = Input('x')
+                y = x.permute(sources)
+                Output('y', y.permute([(i % 8) * 8 + i // 8 for i in range(64)]) * x)
+
+            prog.set_output_ranges(20)
+            prog.set_input_scales(30)
+
+            self.assert_compiles_and_matches_reference(prog,
+                config={'permute_key_budget':budget, 'warn_vec_size':'false'})
+
+        _, params, _ = CKKSCompiler(config={'permute_key_budget':'6', 'warn_vec_size':'false'}).compile(prog)
+        self.assertLessEqual(len(params.rotations), 6)
+
+    def test_call(self):
+        """ Check that calls to functions, also from other functions, match the functions inlined """
+
+        step = EvaProgram('Step', vec_size=64)
+        with step:
+            w = Input('w')
+            x = Input('x')
+            Output('w', w - 0.25 * w * x)
+            Output('d', w * x)
+
+        layers = EvaProgram('Layers', vec_size=64)
+        with layers:
+            w = Input('w')
+            x = Input('x')
+            for _ in range(2):
+                w = Call(step, {'w': w, 'x': x})['w']
+            Output('w', w)
+
+        prog = EvaProgram('Call', vec_size=64)
+        with prog:
+            x = Input('x')
+            w = Call(layers, {'w': Input('w'), 'x': x})['w']
+            results = Call(step, {'w': w, 'x': x})
+            Output('w', results['w'])
+            Output('d', results['d'] + x)
+
+        prog.set_output_ranges(20)
+        prog.set_input_scales(30)
+
+        self.assert_compiles_and_matches_reference(prog,
+            config={'warn_vec_size':'false'})
+
+        inputs = { name: [i % 7 - 3 for i in range(64)] for name in ['w', 'x'] }
+        with tempfile.TemporaryDirectory() as tmp_dir:
+            path = os.path.join(tmp_dir, 'call.eva')
+            save(prog, path)
+            self.assertEqual(evaluate(load(path), inputs), evaluate(prog, inputs))
+
+    def test_output_range_inference(self):
+        """ Check that output ranges are tightened from input ranges """
+
+        prog = EvaProgram('RangeInference', vec_size=1024)
+        with prog:
+            x = Input('x')
+            y = Input('y')
+            Output('z', 3*x**2 + y*[5, -1] - 2)
+
+        prog.set_output_ranges(40)
+        prog.set_input_scales(30)
+
+        progc, params, signature = self.assert_compiles_and_matches_reference(prog,
+            config={'warn_vec_size':'false'})
+        self.assertEqual(params.prime_bits, [60, 20, 60, 60])
+
+        prog.set_input_ranges(1)
+
+        progc, params, signature = self.assert_compiles_and_matches_reference(prog,
+            config={'warn_vec_size':'false'})
+        self.assertEqual(params.prime_bits, [60, 60, 60])
+
+    def test_specialization(self):
+        """ Check that binding unencrypted inputs keeps results unchanged """
+
+        prog = EvaProgram('Specialization', vec_size=1024)
+        with prog:
+            x = Input('x')
+            w = Input('w', False)
+            b = Input('b', False)
+            Output('y', x*w*w + b)
+
+        prog.set_output_ranges(20)
+        prog.set_input_scales(30)
+
+        w = [uniform(-2,2) for _ in range(prog.vec_size)]
+        x = [uniform(-2,2) for _ in range(prog.vec_size)]
+        reference = evaluate(prog, { 'x': x, 'w': w, 'b': [1.5] * prog.vec_size })
+
+        spec = specialize(prog, { 'w': w, 'b': [1.5] })
+        self.assertEqual(set(spec.inputs), { 'x' })
+        self.assertEqual(set(prog.inputs), { 'x', 'w', 'b' })
+        self.assertTrue(valuation_mse(evaluate(spec, { 'x': x }), reference) < 0.0000000001)
+
+        self.assert_compiles_and_matches_reference(spec, inputs = { 'x': x },
+            config={'warn_vec_size':'false'})
+
+        with self.assertRaises(RuntimeError):
+            specialize(prog, { 'x': x })
+
+    def test_constant_interning(self):
+        """ Check that equal constants and encodings are merged """
+
+        prog = EvaProgram('ConstantInterning', vec_size=1024)
+        with prog:
+            x = Input('x')
+            y = Input('y')
+            Output('o1', x*y + (x*[1,2] + y*[1,2,1,2]) + 3 + 3)
+            Output('o2', x + 3)
+
+        prog.set_output_ranges(20)
+        prog.set_input_scales(30)
+
+        progc, params, signature = self.assert_compiles_and_matches_reference(prog,
+            config={'warn_vec_size':'false'})
+        dot = progc.to_DOT()
+        self.assertEqual(dot.count('label="Constant'), 2)
+        self.assertEqual(dot.count('label="Encode'), 3)
+
+    def test_output_compaction(self):
+        """ Check that outputs needing fewer primes are returned smaller under compact_outputs=true """
+
+        prog = EvaProgram('OutputCompaction', vec_size=1024)
+        with prog:
+            x = Input('x')
+            Output('large', x*x*x)
+            Output('small', x + 1)
+
+        prog.set_output_ranges(10)
+        prog.set_output_range('large', 40)
+        prog.set_input_scales(40)
+
+        inputs = { 'x': [uniform(-2,2) for _ in range(prog.vec_size)] }
+        sizes = {}
+        with tempfile.TemporaryDirectory() as tmp_dir:
+            for compact in ['false', 'true']:
+                progc, params, signature = self.assert_compiles_and_matches_reference(prog,
+                    inputs=inputs, config={'compact_outputs':compact, 'warn_vec_size':'false'})
+                public_ctx, secret_ctx = generate_keys(params)
+                encOutputs = public_ctx.execute(progc, public_ctx.encrypt(inputs, signature))
+                path = os.path.join(tmp_dir, compact + '.sealvals')
+                save(encOutputs, path)
+                sizes[compact] = os.path.getsize(path)
+        self.assertLess(sizes['true'], sizes['false'])
+
+    def test_input_packing(self):
+        """ Check that small inputs are packed into one ciphertext under pack_inputs=true """
+
+        prog = EvaProgram('InputPacking', vec_size=16)
+        with prog:
+            a = Input('a')
+            b = Input('b')
+            c = Input('c')
+            d = Input('d')
+            Output('x', a*b + c*d)
+
+        prog.set_output_ranges(20)
+        prog.set_input_scales(30)
+
+        inputs = { name: [uniform(-2,2) for _ in range(prog.vec_size)]
+            for name in prog.inputs }
+        reference = evaluate(prog, inputs)
+
+        compiler = CKKSCompiler(config={'pack_inputs':'true', 'warn_vec_size':'false'})
+        progc, params, signature = compiler.compile(prog)
+        self.assertEqual(len(signature.inputs), 1)
+        self.assertEqual(len(signature.packed_inputs), 4)
+
+        public_ctx, secret_ctx = generate_keys(params)
+        encInputs = public_ctx.encrypt(inputs, signature)
+        outputs = secret_ctx.decrypt(public_ctx.execute(progc, encInputs), signature)
+        mse = valuation_mse(outputs, reference)
+        self.assertTrue(mse < 0.01, f"Mean squared error was {mse}")
+
+    def test_interleaved_input_packing(self):
+        """ Check that rotated inputs are packed interleaved under pack_inputs=true """
+
+        prog = EvaProgram('InterleavedInputPacking', vec_size=16)
+        with prog:
+            a = Input('a')
+            b = Input('b')
+            c = Input('c')
+            d = Input('d')
+            Output('x', (a << 1)*b + (c >> 3) + d*[i/16 for i in range(16)])
+
+        prog.set_output_ranges(20)
+        prog.set_input_scales(30)
+
+        inputs = { name: [uniform(-2,2) for _ in range(prog.vec_size)]
+            for name in prog.inputs }
+        reference = evaluate(prog, inputs)
+
+        compiler = CKKSCompiler(config={'pack_inputs':'true', 'warn_vec_size':'false'})
+        progc, params, signature = compiler.compile(prog)
+        self.assertGreater(signature.stride, 1)
+        self.assertEqual(len(signature.packed_inputs), 4)
+
+        public_ctx, secret_ctx = generate_keys(params)
+        encInputs = public_ctx.encrypt(inputs, signature)
+        outputs = secret_ctx.decrypt(public_ctx.execute(progc, encInputs), signature)
+        mse = valuation_mse(outputs, reference)
+        self.assertTrue(mse < 0.01, f"Mean squared error was {mse}")
+
+    def test_output_packing(self):
+        """ Check that small outputs are returned in one ciphertext under pack_outputs=true """
+
+        prog = EvaProgram('OutputPacking', vec_size=8)
+        with prog:
+            x = Input('x')
+            for i in range(8):
+                Output(f'y{i}', x * (i + 1))
+
+        prog.set_output_ranges(20)
+        prog.set_input_scales(30)
+
+        inputs = { 'x': [uniform(-2,2) for _ in range(prog.vec_size)] }
+        reference = evaluate(prog, inputs)
+
+        compiler = CKKSCompiler(config={'pack_outputs':'true', 'warn_vec_size':'false'})
+        progc, params, signature = compiler.compile(prog)
+        self.assertEqual(len(progc.outputs), 1)
+        self.assertEqual(len(signature.packed_outputs), 8)
+
+        public_ctx, secret_ctx = generate_keys(params)
+        encOutputs = public_ctx.execute(progc, public_ctx.encrypt(inputs, signature))
+        outputs = secret_ctx.decrypt(encOutputs, signature)
+        self.assertEqual(set(outputs.keys()), set(reference.keys()))
+        mse = valuation_mse(outputs, reference)
+        self.assertTrue(mse < 0.01, f"Mean squared error was {mse}")
+
+    def test_batch_instances(self):
+        """ Check that separate instances are computed in the lanes of a ciphertext under batch_instances=true """
+
+        prog = EvaProgram('BatchInstances', vec_size=16)
+        with prog:
+            x = Input('x')
+            y = Input('y')
+            Output('z', x*y + x)
+
+        prog.set_output_ranges(20)
+        prog.set_input_scales(30)
+
+        compiler = CKKSCompiler(config={'batch_instances':'true'})
+        progc, params, signature = compiler.compile(prog)
+        lanes = signature.lanes
+        self.assertEqual(lanes, params.poly_modulus_degree // 2 // prog.vec_size)
+
+        # Each instance has its own x, while y is shared by all of them
+        xs = [[uniform(-2,2) for _ in range(prog.vec_size)] for _ in range(lanes)]
+        y = [uniform(-2,2) for _ in range(prog.vec_size)]
+        public_ctx, secret_ctx = generate_keys(params)
+        encInputs = public_ctx.encrypt({'x': sum(xs, []), 'y': y}, signature)
+        outputs = secret_ctx.decrypt(public_ctx.execute(progc, encInputs), signature)
+        for i in [0, lanes - 1]:
+            reference = evaluate(prog, {'x': xs[i], 'y': y})
+            instance = outputs['z'][i*prog.vec_size:(i+1)*prog.vec_size]
+            mse = valuation_mse({'z': instance}, reference)
+            self.assertTrue(mse < 0.01, f"Mean squared error was {mse}")
+
+        rotating = EvaProgram('RotatingInstances', vec_size=16)
+        with rotating:
+            x = Input('x')
+            Output('z', x + (x << 1))
+        rotating.set_output_ranges(20)
+        rotating.set_input_scales(30)
+        with self.assertRaises(RuntimeError):
+            compiler.compile(rotating)
+
+    def test_tiled_vectors(self):
+        """ Check that vectors larger than the depth needs are split into tiles under tile_vectors=true """
+
+        prog = EvaProgram('TiledVectors', vec_size=8192)
+        with prog:
+            x = Input('x')
+            y = Input('y')
+            Output('z', x*y + (x << 5) + (y >> 3000))
+
+        prog.set_output_ranges(20)
+        prog.set_input_scales(30)
+
+        _, params, _ = CKKSCompiler().compile(prog)
+        compiler = CKKSCompiler(config={'tile_vectors':'true'})
+        progc, tiled_params, signature = compiler.compile(prog)
+        self.assertGreater(signature.tiles, 1)
+        self.assertLess(tiled_params.poly_modulus_degree, params.poly_modulus_degree)
+
+        inputs = {
+            'x': [uniform(-2,2) for _ in range(prog.vec_size)],
+            'y': [uniform(-2,2) for _ in range(prog.vec_size)]
+        }
+        public_ctx, secret_ctx = generate_keys(tiled_params)
+        encInputs = public_ctx.encrypt(inputs, signature)
+        outputs = secret_ctx.decrypt(public_ctx.execute(progc, encInputs), signature)
+        reference = evaluate(prog, inputs)
+        mse = valuation_mse(outputs, reference)
+        self.assertTrue(mse < 0.01, f"Mean squared error was {mse}")
+
+    def test_compile_family(self):
+        """ Check that programs compiled together run with one set of keys """
+
+        def make_program(name, degree, scale, rotation):
+            prog = EvaProgram(name, vec_size=64)
+            with prog:
+                x = Input('x')
+                y = x**degree
+                Output('y', y + (y << rotation))
+            prog.set_output_ranges(20)
+            prog.set_input_scales(scale)
+            return prog
+
+        family = [make_program('A', 4, 30, 1), make_program('B', 2, 30, 3), make_program('C', 3, 50, 2)]
+        compiler = CKKSCompiler(config={'warn_vec_size':'false'})
+        compiled, params, signatures = compiler.compile_family(family)
+        public_ctx, secret_ctx = generate_keys(params)
+
+        other = make_program('D', 2, 30, 1)
+        other_compiled, other_signature = compiler.compile(other, params)
+
+        for prog, compiled_prog, signature in zip(family + [other], compiled + [other_compiled], signatures + [other_signature]):
+            inputs = { 'x': [uniform(-1, 1) for _ in range(prog.vec_size)] }
+            encOutputs = public_ctx.execute(compiled_prog, public_ctx.encrypt(inputs, signature))
+            outputs = secret_ctx.decrypt(encOutputs, signature)
+            self.assertLess(valuation_mse(outputs, evaluate(prog, inputs)), 0.01)
+
+        with self.assertRaises(RuntimeError):
+            compiler.compile(make_program('E', 2, 30, 5), params)
+
+    def test_restricted_public_context(self):
+        """ Check that a public context restricted to a program is smaller and still runs it """
+
+        square = EvaProgram('Square', vec_size=64)
+        with square:
+            x = Input('x')
+            Output('y', x*x + (x << 1))
+        scale = EvaProgram('Scale', vec_size=64)
+        with scale:
+            x = Input('x')
+            Output('y', 2*x + (x << 3) + (x << 5))
+        for prog in [square, scale]:
+            prog.set_output_ranges(20)
+            prog.set_input_scales(30)
+
+        compiler = CKKSCompiler(config={'warn_vec_size':'false'})
+        compiled, params, signatures = compiler.compile_family([square, scale])
+        public_ctx, secret_ctx = generate_keys(params)
+
+        with tempfile.TemporaryDirectory() as tmp_dir:
+            tmp_path = lambda x: os.path.join(tmp_dir, x)
+            save(public_ctx, tmp_path('full.sealpublic'))
+            for prog, compiled_prog, signature in zip([square, scale], compiled, signatures):
+                save(public_ctx.restrict_to(compiled_prog), tmp_path('restricted.sealpublic'))
+                self.assertLess(os.path.getsize(tmp_path('restricted.sealpublic')), os.path.getsize(tmp_path('full.sealpublic')))
+
+                restricted_ctx = load(tmp_path('restricted.sealpublic'))
+                inputs = { 'x': [uniform(-1, 1) for _ in range(prog.vec_size)] }
+                encOutputs = restricted_ctx.execute(compiled_prog, restricted_ctx.encrypt(inputs, signature))
+                outputs = secret_ctx.decrypt(encOutputs, signature)
+                self.assertLess(valuation_mse(outputs, evaluate(prog, inputs)), 0.01)
+
+    def test_seeded_keys(self):
+        """ Check that keys are generated on demand and saved at half size with seeds """
+
+        prog = EvaProgram('Rotations', vec_size=64)
+        with prog:
+            x = Input('x')
+            Output('y', 2*x + (x << 1) + (x << 2) + (x >> 3))
+        prog.set_output_ranges(20)
+        prog.set_input_scales(30)
+
+        compiled, params, signature = CKKSCompiler(config={'warn_vec_size':'false'}).compile(prog)
+        self.assertFalse(params.needs_relin_keys)
+
+        inputs = { 'x': [uniform(-1, 1) for _ in range(prog.vec_size)] }
+        reference = evaluate(prog, inputs)
+        with tempfile.TemporaryDirectory() as tmp_dir:
+            tmp_path = lambda x: os.path.join(tmp_dir, x)
+            for seeded in [False, True]:
+                public_ctx, secret_ctx = generate_keys(params, seeded=seeded)
+                save(public_ctx, tmp_path(f'{seeded}.sealpublic'))
+                public_ctx = load(tmp_path(f'{seeded}.sealpublic'))
+                encOutputs = public_ctx.execute(compiled, public_ctx.encrypt(inputs, signature))
+                outputs = secret_ctx.decrypt(encOutputs, signature)
+                self.assertLess(valuation_mse(outputs, reference), 0.01)
+            self.assertLess(os.path.getsize(tmp_path('True.sealpublic')), 0.6 * os.path.getsize(tmp_path('False.sealpublic')))
+
+    def test_context_capacity(self):
+        """ Check that contexts dropped from the registry stay usable """
+
+        runs = []
+        for scale in [25, 35]:
+            prog = EvaProgram(f'Scale{scale}', vec_size=64)
+            with prog:
+                x = Input('x')
+                Output('y', x*x + (x << 1))
+            prog.set_output_ranges(20)
+            prog.set_input_scales(scale)
+            compiled, params, signature = CKKSCompiler(config={'warn_vec_size':'false'}).compile(prog)
+            prewarm_context(params)
+            runs.append((prog, compiled, signature, generate_keys(params)))
+
+        capacity = get_context_capacity()
+        set_context_capacity(1)
+        try:
+            for prog, compiled, signature, (public_ctx, secret_ctx) in runs + runs:
+                inputs = { 'x': [uniform(-1, 1) for _ in range(prog.vec_size)] }
+                encOutputs = public_ctx.execute(compiled, public_ctx.encrypt(inputs, signature))
+                outputs = secret_ctx.decrypt(encOutputs, signature)
+                self.assertLess(valuation_mse(outputs, evaluate(prog, inputs)), 0.01)
+        finally:
+            set_context_capacity(capacity)
+
+    def test_flat_program(self):
+        """ Check that a program in the flat format executes like the program it was saved from """
+
+        prog = EvaProgram('Flat', vec_size=64)
+        with prog:
+            x = Input('x')
+            y = Input('y', False)
+            Output('z', (x*x + [i/64 for i in range(64)]) << 3)
+            Output('w', y*2 + 1)
+        prog.set_output_ranges(20)
+        prog.set_input_scales(30)
+
+        compiled, params, signature = CKKSCompiler(config={'warn_vec_size':'false'}).compile(prog)
+        public_ctx, secret_ctx = generate_keys(params)
+        inputs = { name: [uniform(-1, 1) for _ in range(prog.vec_size)] for name in prog.inputs }
+        encInputs = public_ctx.encrypt(inputs, signature)
+
+        with tempfile.TemporaryDirectory() as tmp_dir:
+            path = os.path.join(tmp_dir, 'flat.evaflat')
+            save_flat(compiled, path)
+            flat = load_flat(path)
+            self.assertEqual(flat.vec_size, compiled.vec_size)
+            outputs = secret_ctx.decrypt(public_ctx.execute(flat, encInputs), signature)
+        self.assertEqual(outputs, secret_ctx.decrypt(public_ctx.execute(compiled, encInputs), signature))
+        self.assertLess(valuation_mse(outputs, evaluate(prog, inputs)), 0.01)
+
+    def test_corrupt_flat_program(self):
+        """ Check that loading flat programs whose terms have the wrong operands or names throws """
+
+        prog = EvaProgram('Corrupt', vec_size=64)
+        with prog:
+            x = Input('x')
+            Output('y', x*x)
+        prog.set_output_ranges(20)
+        prog.set_input_scales(30)
+        compiled, params, signature = CKKSCompiler(config={'warn_vec_size':'false'}).compile(prog)
+
+        with tempfile.TemporaryDirectory() as tmp_dir:
+            path = os.path.join(tmp_dir, 'flat.evaflat')
+            save_flat(compiled, path)
+            with open(path, 'rb') as f:
+                data = f.read()
+            term_count, = struct.unpack_from('<I', data, 20)
+            terms_offset, = struct.unpack_from('<Q', data, 64)
+            # Each term is its op, operand count, first operand, attribute count, first attribute and a reserved word
+            ops = [struct.unpack_from('<I', data, terms_offset + 24*i)[0] for i in range(term_count)]
+            mul = terms_offset + 24*ops.index(13)
+            output = terms_offset + 24*ops.index(2)
+            for offset, value in [(mul + 4, 1), (output, 10)]:
+                corrupt = bytearray(data)
+                struct.pack_into('<I', corrupt, offset, value)
+                with open(path, 'wb') as f:
+                    f.write(corrupt)
+                with self.assertRaises(RuntimeError):
+                    load_flat(path)
+
+    def test_bundle(self):
+        """ Check that a program loaded from a bundle executes like the program it was saved from """
+
+        prog = EvaProgram('Bundle', vec_size=64)
+        with prog:
+            x = Input('x')
+            Output('y', (x*x*[i/64 for i in range(64)] << 3) + 2)
+        prog.set_output_ranges(20)
+        prog.set_input_scales(30)
+
+        compiled, params, signature = CKKSCompiler(config={'warn_vec_size':'false'}).compile(prog)
+        public_ctx, secret_ctx = generate_keys(params)
+        inputs = { 'x': [uniform(-1, 1) for _ in range(prog.vec_size)] }
+        encInputs = public_ctx.encrypt(inputs, signature)
+
+        with tempfile.TemporaryDirectory() as tmp_dir:
+            path = os.path.join(tmp_dir, 'program.evabundle')
+            save_bundle(compiled, params, signature, public_ctx, path)
+            bundle = load_bundle(path)
+            self.assertEqual(bundle.program.vec_size, compiled.vec_size)
+            outputs = secret_ctx.decrypt(bundle.execute(encInputs), bundle.signature)
+            workerInputs = bundle.public_ctx.encrypt(inputs, bundle.signature)
+            workerOutputs = secret_ctx.decrypt(bundle.execute(workerInputs), signature)
+        self.assertEqual(outputs, secret_ctx.decrypt(public_ctx.execute(compiled, encInputs), signature))
+        self.assertLess(valuation_mse(workerOutputs, evaluate(prog, inputs)), 0.01)
+
+    def test_bound_inputs(self):
+        """ Check that a bundle with its plaintext inputs bound executes with only the ciphertext inputs """
+
+        prog = EvaProgram('Bound', vec_size=64)
+        with prog:
+            x = Input('x')
+            w = Input('w', is_encrypted=False)
+            Output('y', (x*w << 1) + w*w)
+        prog.set_output_ranges(20)
+        prog.set_input_scales(30)
+
+        compiled, params, signature = CKKSCompiler(config={'warn_vec_size':'false'}).compile(prog)
+        public_ctx, secret_ctx = generate_keys(params)
+        inputs = { 'x': [uniform(-1, 1) for _ in range(prog.vec_size)],
+                   'w': [uniform(-1, 1) for _ in range(prog.vec_size)] }
+
+        with tempfile.TemporaryDirectory() as tmp_dir:
+            path = os.path.join(tmp_dir, 'program.evabundle')
+            save_bundle(compiled, params, signature, public_ctx, path)
+            bundle = load_bundle(path)
+            bundle.bind(public_ctx.encrypt({ 'w': inputs['w'] }, signature))
+            outputs = secret_ctx.decrypt(bundle.execute(public_ctx.encrypt({ 'x': inputs['x'] }, signature)), signature)
+            with self.assertRaises(RuntimeError):
+                bundle.execute(public_ctx.encrypt(inputs, signature))
+        self.assertLess(valuation_mse(outputs, evaluate(prog, inputs)), 0.01)
+
+    def test_prepared_program(self):
+        """ Check that a program prepared with its plaintext inputs bound executes with only the ciphertext inputs """
+
+        prog = EvaProgram('Prepared', vec_size=64)
+        with prog:
+            x = Input('x')
+            w = Input('w', is_encrypted=False)
+            Output('y', (x*w << 1) + w*w)
+        prog.set_output_ranges(20)
+        prog.set_input_scales(30)
+
+        compiled, params, signature = CKKSCompiler(config={'warn_vec_size':'false'}).compile(prog)
+        public_ctx, secret_ctx = generate_keys(params)
+        inputs = { 'x': [uniform(-1, 1) for _ in range(prog.vec_size)],
+                   'w': [uniform(-1, 1) for _ in range(prog.vec_size)] }
+
+        fixed = public_ctx.prepare(compiled, public_ctx.encrypt({ 'w': inputs['w'] }, signature))
+        for _ in range(2):
+            outputs = secret_ctx.decrypt(public_ctx.execute(compiled, public_ctx.encrypt({ 'x': inputs['x'] }, signature), fixed), signature)
+            self.assertLess(valuation_mse(outputs, evaluate(prog, inputs)), 0.01)
+        with self.assertRaises(RuntimeError):
+            public_ctx.execute(compiled, public_ctx.encrypt(inputs, signature), fixed)
+
+    def test_aliased_outputs(self):
+        """ Check that outputs of the same value, and outputs of inputs, are all returned """
+
+        prog = EvaProgram('Aliased', vec_size=64)
+        with prog:
+            x = Input('x')
+            y = x*x << 1
+            Output('a', y)
+            Output('b', y)
+            Output('x', x)
+        prog.set_output_ranges(20)
+        prog.set_input_scales(30)
+
+        compiled, params, signature = CKKSCompiler(config={'warn_vec_size':'false'}).compile(prog)
+        public_ctx, secret_ctx = generate_keys(params)
+        inputs = { 'x': [uniform(-1, 1) for _ in range(prog.vec_size)] }
+        outputs = secret_ctx.decrypt(public_ctx.execute(compiled, public_ctx.encrypt(inputs, signature)), signature)
+        self.assertEqual(set(outputs), {'a', 'b', 'x'})
+        self.assertEqual(outputs['a'], outputs['b'])
+        self.assertLess(valuation_mse(outputs, evaluate(prog, inputs)), 0.01)
+
+    def test_constant_encoding(self):
+        """ Check that programs saved with encoded constants are smaller and compute the same outputs """
+
+        mask = [1 if i < 256 else 0 for i in range(1024)]
+        weights = [i/1024 for i in range(1024)]
+        prog = EvaProgram('Constants', vec_size=1024)
+        with prog:
+            x = Input('x')
+            Output('y', x*weights + (x << 1)*mask + (x << 2)*mask)
+        prog.set_output_ranges(20)
+        prog.set_input_scales(30)
+
+        compiled, params, signature = CKKSCompiler(config={'warn_vec_size':'false'}).compile(prog)
+        public_ctx, secret_ctx = generate_keys(params)
+        inputs = { 'x': [uniform(-1, 1) for _ in range(prog.vec_size)] }
+        encInputs = public_ctx.encrypt(inputs, signature)
+        reference = secret_ctx.decrypt(public_ctx.execute(compiled, encInputs), signature)
+
+        lossless = ConstantEncoding()
+        lossless.deduplicate = True
+        lossless.run_length = True
+        quantized = ConstantEncoding()
+        quantized.quantization = ConstantQuantization.FixedPoint
+        quantized.max_error = 1e-6
+        compressed = ConstantEncoding()
+        compressed.compress = True
+
+        with tempfile.TemporaryDirectory() as tmp_dir:
+            path = os.path.join(tmp_dir, 'plain.eva')
+            save(compiled, path)
+            plain_size = os.path.getsize(path)
+            for constants in [lossless, quantized]:
+                path = os.path.join(tmp_dir, 'encoded.eva')
+                save(compiled, path, constants)
+                self.assertLess(os.path.getsize(path), plain_size)
+                outputs = secret_ctx.decrypt(public_ctx.execute(load(path), encInputs), signature)
+                self.assertLess(valuation_mse(outputs, reference), 1e-6)
+
+            path = os.path.join(tmp_dir, 'encoded.evaflat')
+            save_flat(compiled, path, lossless)
+            outputs = secret_ctx.decrypt(public_ctx.execute(load_flat(path), encInputs), signature)
+            self.assertEqual(outputs, reference)
+
+            path = os.path.join(tmp_dir, 'compressed.eva')
+            try:
+                save(compiled, path, compressed)
+            except RuntimeError:
+                self.skipTest('EVA was built without zlib')
+            self.assertLess(os.path.getsize(path), plain_size)
+            outputs = secret_ctx.decrypt(public_ctx.execute(load(path), encInputs), signature)
+        self.assertLess(valuation_mse(outputs, reference), 1e-6)
+
     def test_seal_no_throw_on_transparent(self):
         """ Check that SEAL is compiled with -DSEAL_THROW_ON_TRANSPARENT_CIPHERTEXT=OFF
         
@@ -4,7 +4,8 @@
 import unittest
 from common import *
 from eva import EvaProgram, Input, Output
-from eva.std.numeric import horizontal_sum
+from eva.std.numeric import horizontal_sum, segmented_sum, broadcast, dot_products
+from eva.std.convolution import convolve2d
 
 class Std(EvaTestCase):
     def test_horizontal_sum(self):
@@ -34,5 +35,100 @@ class Std(EvaTestCase):
         self.assert_compiles_and_matches_reference(prog,
             config={'warn_vec_size':'false'})
 
+    def test_segmented_sum(self):
+        """ Test eva.std.numeric.segmented_sum """
+
+        for replicate in [False, True]:
+            prog = EvaProgram('SegmentedSum', vec_size = 1024)
+            with prog:
+                x = Input('x')
+                Output('y', segmented_sum(x, 16, replicate))
+
+            prog.set_output_ranges(25)
+            prog.set_input_scales(33)
+
+            inputs = { 'x': [uniform(-2,2) for _ in range(prog.vec_size)] }
+            outputs = evaluate(prog, inputs)
+            for i in range(0, prog.vec_size, 16 if not replicate else 1):
+                first = i - i % 16
+                self.assertAlmostEqual(outputs['y'][i], sum(inputs['x'][first:first + 16]))
+
+            self.assert_compiles_and_matches_reference(prog, inputs,
+                config={'warn_vec_size':'false'})
+
+    def test_broadcast(self):
+        """ Test eva.std.numeric.broadcast """
+
+        for size, slot in [(1024, 5), (16, 3)]:
+            prog = EvaProgram('Broadcast', vec_size = 1024)
+            with prog:
+                x = Input('x')
+                Output('y', broadcast(x, slot, size))
+
+            prog.set_output_ranges(25)
+            prog.set_input_scales(33)
+
+            inputs = { 'x': [uniform(-2,2) for _ in range(prog.vec_size)] }
+            outputs = evaluate(prog, inputs)
+            for i in range(prog.vec_size):
+                self.assertAlmostEqual(outputs['y'][i], inputs['x'][i - i % size + slot])
+
+            self.assert_compiles_and_matches_reference(prog, inputs,
+                config={'warn_vec_size':'false'})
+
+    def test_dot_products(self):
+        """ Test eva.std.numeric.dot_products """
+
+        for count in [1, 3, 8]:
+            prog = EvaProgram('DotProducts', vec_size = 1024)
+            with prog:
+                pairs = [(Input(f'a{j}'), Input(f'b{j}')) for j in range(count)]
+                Output('y', dot_products(pairs))
+
+            prog.set_output_ranges(25)
+            prog.set_input_scales(33)
+
+            inputs = { name: [uniform(-1,1) for _ in range(prog.vec_size)]
+                for name in prog.inputs }
+            outputs = evaluate(prog, inputs)
+            stride = prog.vec_size // (1 << (count - 1).bit_length())
+            for j in range(count):
+                expected = sum(a * b for a, b in zip(inputs[f'a{j}'], inputs[f'b{j}']))
+                self.assertAlmostEqual(outputs['y'][j * stride], expected)
+
+            self.assert_compiles_and_matches_reference(prog, inputs,
+                config={'warn_vec_size':'false'})
+
+    def test_convolve2d(self):
+        """ Test eva.std.convolution.convolve2d """
+
+        width = 16
+        filters = [
+            [[[-1, 0, 1], [-2, 0, 2], [-1, 0, 1]], [[1, 2, 1], [0, 0, 0], [-1, -2, -1]]],
+            [[[0.5, 0.5, 0.5], [0.5, 1, 0.5], [0.5, 0.5, 0.5]], [[0, 0, 0], [0, 1, 0], [0, 0, 0]]]]
+        for stride in [1, 2]:
+            prog = EvaProgram('Convolve2D', vec_size = 256)
+            with prog:
+                channels = [Input('r'), Input('g')]
+                for f, result in enumerate(convolve2d(channels, width, filters, stride)):
+                    Output(f'y{f}', result)
+
+            prog.set_output_ranges(25)
+            prog.set_input_scales(33)
+
+            inputs = { name: [uniform(-2,2) for _ in range(prog.vec_size)]
+                for name in prog.inputs }
+            outputs = evaluate(prog, inputs)
+            for f, kernels in enumerate(filters):
+                for y in range(0, prog.vec_size // width - 2, stride):
+                    for x in range(0, width - 2, stride):
+                        expected = sum(kernel[i][j] * inputs[c][(y + i) * width + x + j]
+                            for c, kernel in zip(['r', 'g'], kernels)
+                            for i in range(3) for j in range(3))
+                        self.assertAlmostEqual(outputs[f'y{f}'][y * width + x], expected)
+
+            self.assert_compiles_and_matches_reference(prog, inputs,
+                config={'warn_vec_size':'false'})
+
 if __name__ == '__main__':
     unittest.main()
\ No newline at end of file